@@ -50,12 +50,14 @@ rm -rf $RPM_BUILD_ROOT
 # Note these are not versioned - they are modules, not shlibs
 %{_libdir}/libXrdFileCache.so
 %{_libdir}/libXrdFileCacheAllowAlways.so
+%{_libdir}/libXrdFileCachePopularity.so
 %{_sysconfdir}/xrootd/xrootd.sample.file-cache.cfg
 
 %files devel
 %{_includedir}/Decision.hh
 %{_bindir}/xrdreadv
 %{_bindir}/xrdfragcp
+%{_bindir}/xrdcrcbench
 
 %changelog
 * Fri Nov 2 2012 Brian Bockelman <bbockelm@cse.unl.edu> - 0.4-1
@@ -0,0 +1,145 @@
+
+#include <algorithm>
+
+#include "AccessPattern.hh"
+
+using namespace XrdFileCache;
+
+// Scores saturate here so that a long sequential run is forgotten after a
+// handful of seeks.
+const int AccessPattern::m_max_score = 8;
+
+// Strides read ahead of a strided reader.
+const int AccessPattern::m_max_strides = 4;
+
+AccessPattern::AccessPattern(long long minWindow, long long maxWindow, long long fileSize)
+    : m_min_window(std::min(minWindow, maxWindow)),
+      m_max_window(maxWindow),
+      m_file_size(fileSize),
+      m_window(m_min_window),
+      m_last_offset(0),
+      m_last_end(0),
+      m_stride(0),
+      m_readahead_end(0),
+      m_reads(0),
+      m_sequential_score(0),
+      m_stride_score(0),
+      m_vector_score(0),
+      m_last_vector(false),
+      m_kind(kUnknown)
+{
+}
+
+/*
+ * A read starting at most one minimum window past the end of the last one
+ * counts as continuing it; anything else resets the window.
+ */
+void
+AccessPattern::Record(long long offset, long long size)
+{
+    long long gap = offset - m_last_end;
+    if (m_reads && gap >= 0 && gap <= m_min_window)
+    {
+        m_sequential_score = std::min(m_sequential_score + 1, m_max_score);
+        if (m_sequential_score >= 2)
+            m_window = std::min(2 * m_window, m_max_window);
+    }
+    else if (m_reads)
+    {
+        m_sequential_score /= 2;
+        m_window = m_min_window;
+        long long stride = offset - m_last_offset;
+        if (stride && stride == m_stride)
+        {
+            m_stride_score = std::min(m_stride_score + 1, m_max_score);
+        }
+        else
+        {
+            m_stride = stride;
+            m_stride_score = 0;
+            m_readahead_end = 0;
+        }
+    }
+    if (m_vector_score) m_vector_score--;
+    m_last_vector = false;
+    m_last_offset = offset;
+    m_last_end = offset + size;
+    m_reads++;
+    Classify();
+}
+
+/*
+ * Vector reads rarely continue each other exactly; one which starts past
+ * the start of the previous one counts as moving forward.
+ */
+void
+AccessPattern::RecordV(long long lo, long long hi)
+{
+    if (m_last_vector && lo >= m_last_offset)
+    {
+        m_vector_score = std::min(m_vector_score + 1, m_max_score);
+        if (m_vector_score >= 2)
+            m_window = std::min(2 * m_window, m_max_window);
+    }
+    else
+    {
+        m_vector_score = 0;
+        m_window = m_min_window;
+        m_readahead_end = 0;
+    }
+    m_sequential_score /= 2;
+    m_last_vector = true;
+    m_last_offset = lo;
+    m_last_end = hi;
+    m_reads++;
+    Classify();
+}
+
+void
+AccessPattern::Classify()
+{
+    if (m_last_vector && m_vector_score >= 2)
+        m_kind = kVector;
+    else if (m_sequential_score >= 2)
+        m_kind = kSequential;
+    else if (m_stride_score >= 2)
+        m_kind = kStrided;
+    else if (m_reads >= 4)
+        m_kind = kRandom;
+    else
+        m_kind = kUnknown;
+}
+
+void
+AccessPattern::GetReadahead(Ranges &ranges)
+{
+    ranges.clear();
+    if (m_max_window <= 0)
+        return;
+
+    if (m_kind == kSequential || m_kind == kVector)
+    {
+        // Top the window up once the reader is half way through it.
+        long long start = std::max(m_last_end, m_readahead_end);
+        long long end = std::min(m_last_end + m_window, m_file_size);
+        if (start - m_last_end >= m_window / 2 || end <= start)
+            return;
+        ranges.push_back(std::make_pair(start, end - start));
+        m_readahead_end = end;
+    }
+    else if (m_kind == kStrided)
+    {
+        long long size = m_last_end - m_last_offset;
+        for (int i = 1; i <= m_max_strides; i++)
+        {
+            long long offset = m_last_offset + i * m_stride;
+            if (offset < 0 || offset >= m_file_size)
+                break;
+            if (m_stride > 0 && offset + size <= m_readahead_end)
+                continue;
+            ranges.push_back(std::make_pair(offset, std::min(size, m_file_size - offset)));
+            if (m_stride > 0)
+                m_readahead_end = offset + size;
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef __XRDFILECACHE_ACCESSPATTERN_HH__
+#define __XRDFILECACHE_ACCESSPATTERN_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * Classifies the reads made through one client handle and works out what
+ * should be read ahead for it.  Sequential readers get a window which
+ * doubles on every read that continues the last one, up to a configured
+ * maximum; strided readers get the next few strides; vector readers
+ * moving forward through the file get a window past their last chunk.
+ * Random readers get nothing beyond what they ask for.
+ *
+ * Not thread safe; the owner serializes calls.
+ */
+
+#include <utility>
+#include <vector>
+
+namespace XrdFileCache {
+
+class AccessPattern
+{
+
+public:
+
+    enum Kind {kUnknown, kSequential, kStrided, kRandom, kVector};
+
+    typedef std::vector<std::pair<long long, long long> > Ranges; // offset, length
+
+    AccessPattern(long long minWindow, long long maxWindow, long long fileSize);
+
+    void Record(long long offset, long long size);
+
+    // A vector read whose chunks span [lo, hi).
+    void RecordV(long long lo, long long hi);
+
+    // Ranges to read ahead of the latest access which have not been
+    // handed out before.  Empty when the current window is still mostly
+    // ahead of the reader.
+    void GetReadahead(Ranges &ranges);
+
+    // Whether the reader has been sequential for long enough to justify
+    // fetching the rest of the file.
+    bool WantsFullFile() const {return m_kind == kSequential && m_max_window > 0 && m_window >= m_max_window;}
+
+    Kind GetKind() const {return m_kind;}
+
+private:
+
+    void Classify();
+
+    static const int m_max_score;
+    static const int m_max_strides;
+
+    long long m_min_window;
+    long long m_max_window;
+    long long m_file_size;
+    long long m_window;
+
+    long long m_last_offset;
+    long long m_last_end;
+    long long m_stride;
+    long long m_readahead_end; // end of the furthest range handed out
+
+    int m_reads;
+    int m_sequential_score;
+    int m_stride_score;
+    int m_vector_score;
+    bool m_last_vector;
+
+    Kind m_kind;
+
+};
+
+}
+
+#endif
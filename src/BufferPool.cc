@@ -0,0 +1,189 @@
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <new>
+
+#include "BufferPool.hh"
+
+using namespace XrdFileCache;
+
+const size_t BufferPool::m_class_sizes[kNumClasses] = {
+    64*1024, 256*1024, 1024*1024, 4*1024*1024, 16*1024*1024
+};
+
+namespace
+{
+// Each thread keeps up to this many bytes, and at most eight buffers, of
+// each class up to the largest cached one.  Bigger buffers are rare enough
+// to share.
+const size_t thread_cache_bytes = 4*1024*1024;
+const int thread_cache_depth = 8;
+const size_t thread_cache_max_size = 1024*1024;
+
+int
+ThreadCacheDepth(size_t size)
+{
+    int depth = thread_cache_bytes / size;
+    return depth < 1 ? 1 : (depth > thread_cache_depth ? thread_cache_depth : depth);
+}
+}
+
+struct BufferPool::ThreadCache
+{
+    char *m_buffers[BufferPool::kNumClasses][thread_cache_depth];
+    int m_count[BufferPool::kNumClasses];
+};
+
+// Lookups go through m_thread_cache; the pool's key only serves to have
+// the cache released when its thread exits.
+__thread BufferPool::ThreadCache *BufferPool::m_thread_cache = NULL;
+
+BufferPool::BufferPool()
+    : m_cap(256*1024*1024),
+      m_allocated(0),
+      m_high_water(0),
+      m_in_use(0),
+      m_in_use_high_water(0)
+{
+    pthread_key_create(&m_thread_key, ReleaseThreadCache);
+}
+
+BufferPool &
+BufferPool::GetInstance()
+{
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::ThreadCache *
+BufferPool::GetThreadCache()
+{
+    if (!m_thread_cache)
+    {
+        m_thread_cache = new ThreadCache;
+        for (int i = 0; i < kNumClasses; i++)
+            m_thread_cache->m_count[i] = 0;
+        pthread_setspecific(m_thread_key, m_thread_cache);
+    }
+    return m_thread_cache;
+}
+
+void
+BufferPool::RaiseHighWater(long long &mark, long long value)
+{
+    long long old = __atomic_load_n(&mark, __ATOMIC_RELAXED);
+    while (value > old && !__atomic_compare_exchange_n(&mark, &old, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+char *
+BufferPool::NewBuffer(size_t size)
+{
+    void *data;
+    if (posix_memalign(&data, 4096, size))
+        throw std::bad_alloc();
+    RaiseHighWater(m_high_water, __sync_add_and_fetch(&m_allocated, static_cast<long long>(size)));
+    return static_cast<char *>(data);
+}
+
+void
+BufferPool::DeleteBuffer(char *data, size_t size)
+{
+    free(data);
+    __sync_fetch_and_sub(&m_allocated, static_cast<long long>(size));
+}
+
+char *
+BufferPool::Allocate(size_t size, int &cls)
+{
+    RaiseHighWater(m_in_use_high_water, __sync_add_and_fetch(&m_in_use, static_cast<long long>(size)));
+
+    for (cls = 0; cls < kNumClasses && m_class_sizes[cls] < size; cls++)
+        ;
+    if (cls == kNumClasses)
+    {
+        cls = -1;
+        return NewBuffer(size);
+    }
+
+    if (m_class_sizes[cls] <= thread_cache_max_size)
+    {
+        ThreadCache *cache = GetThreadCache();
+        if (cache->m_count[cls])
+            return cache->m_buffers[cls][--cache->m_count[cls]];
+    }
+    {
+        XrdSysMutexHelper lock(m_mutex);
+        if (!m_free[cls].empty())
+        {
+            char *data = m_free[cls].back();
+            m_free[cls].pop_back();
+            return data;
+        }
+    }
+    return NewBuffer(m_class_sizes[cls]);
+}
+
+void
+BufferPool::Free(char *data, size_t size, int cls)
+{
+    __sync_fetch_and_sub(&m_in_use, static_cast<long long>(size));
+    if (cls < 0)
+    {
+        DeleteBuffer(data, size);
+        return;
+    }
+
+    size_t class_size = m_class_sizes[cls];
+    if (class_size <= thread_cache_max_size && GetAllocated() <= m_cap)
+    {
+        ThreadCache *cache = GetThreadCache();
+        if (cache->m_count[cls] < ThreadCacheDepth(class_size))
+        {
+            cache->m_buffers[cls][cache->m_count[cls]++] = data;
+            return;
+        }
+    }
+    Pool(data, cls);
+}
+
+// Put a buffer on the shared free list, or free it if over the cap.
+void
+BufferPool::Pool(char *data, int cls)
+{
+    if (GetAllocated() <= m_cap)
+    {
+        XrdSysMutexHelper lock(m_mutex);
+        m_free[cls].push_back(data);
+        return;
+    }
+    DeleteBuffer(data, m_class_sizes[cls]);
+}
+
+// Runs as the thread-specific data destructor of an exiting thread.
+void
+BufferPool::ReleaseThreadCache(void *cache)
+{
+    ThreadCache *thread_cache = static_cast<ThreadCache *>(cache);
+    BufferPool &pool = GetInstance();
+    for (int cls = 0; cls < kNumClasses; cls++)
+        while (thread_cache->m_count[cls])
+            pool.Pool(thread_cache->m_buffers[cls][--thread_cache->m_count[cls]], cls);
+    delete thread_cache;
+    m_thread_cache = NULL;
+}
+
+BufferPool::Buffer::Buffer(size_t size)
+    : m_data(NULL),
+      m_size(size),
+      m_class(-1)
+{
+    if (size)
+        m_data = BufferPool::GetInstance().Allocate(size, m_class);
+}
+
+BufferPool::Buffer::~Buffer()
+{
+    if (m_data)
+        BufferPool::GetInstance().Free(m_data, m_size, m_class);
+}
@@ -0,0 +1,95 @@
+#ifndef __XRDFILECACHE_BUFFERPOOL_HH__
+#define __XRDFILECACHE_BUFFERPOOL_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * Process-wide pool of page-aligned I/O buffers in a few size classes, so
+ * that prefetching, miss handling and readv staging do not go to the
+ * allocator for every block.  Each thread keeps a few free buffers of the
+ * smaller classes to itself, handed back to the shared free lists when it
+ * exits; the rest go straight back to those lists.  Requests larger than
+ * the largest class are allocated and freed directly.
+ *
+ * A buffer is never refused: the cap only limits how much memory is kept
+ * around, so buffers returned while more than the cap is allocated, which
+ * counts those held by threads, are freed rather than pooled.
+ */
+
+#include <stddef.h>
+#include <vector>
+
+#include <XrdSys/XrdSysPthread.hh>
+
+namespace XrdFileCache {
+
+class BufferPool
+{
+
+public:
+
+    static const int kNumClasses = 5;
+
+    // A buffer borrowed for the lifetime of the object.
+    class Buffer
+    {
+    public:
+        Buffer(size_t size);
+        ~Buffer();
+        char *Get() {return m_data;}
+        size_t Size() const {return m_size;}
+    private:
+        Buffer(const Buffer &);
+        Buffer &operator=(const Buffer &);
+        char *m_data;
+        size_t m_size;
+        int m_class;
+    };
+
+    BufferPool();
+
+    void SetCap(long long cap) {m_cap = cap;}
+
+    // Bytes of buffers in existence, pooled or lent out, now and at most.
+    long long GetAllocated() const {return __atomic_load_n(&m_allocated, __ATOMIC_RELAXED);}
+    long long GetHighWater() const {return __atomic_load_n(&m_high_water, __ATOMIC_RELAXED);}
+    // Bytes lent out now and at most.
+    long long GetInUse() const {return __atomic_load_n(&m_in_use, __ATOMIC_RELAXED);}
+    long long GetInUseHighWater() const {return __atomic_load_n(&m_in_use_high_water, __ATOMIC_RELAXED);}
+
+    static BufferPool &GetInstance();
+
+private:
+
+    char *Allocate(size_t size, int &cls);
+    void Free(char *data, size_t size, int cls);
+    void Pool(char *data, int cls);
+
+    struct ThreadCache;
+    ThreadCache *GetThreadCache();
+    static void ReleaseThreadCache(void *cache);
+    static __thread ThreadCache *m_thread_cache;
+    char *NewBuffer(size_t size);
+    void DeleteBuffer(char *data, size_t size);
+    static void RaiseHighWater(long long &mark, long long value);
+
+    static const size_t m_class_sizes[kNumClasses];
+
+    XrdSysMutex m_mutex;
+    pthread_key_t m_thread_key; // releases a thread's cache when it exits
+    std::vector<char *> m_free[kNumClasses];
+    long long m_cap;
+    long long m_allocated;
+    long long m_high_water;
+    long long m_in_use;
+    long long m_in_use_high_water;
+
+};
+
+}
+
+#endif
@@ -1,66 +1,72 @@
 #include "XrdSys/XrdSysPthread.hh"
 #include "XrdOss/XrdOss.hh"
-#include "XrdOuc/XrdOucEnv.hh"
-
-#include <fcntl.h>
-
 
 #include "IO.hh"
 #include "Cache.hh"
 #include "Factory.hh"
 #include "Prefetch.hh"
+#include "Scheduler.hh"
+#include "CachedFile.hh"
+#include "FileTable.hh"
+#include "Catalog.hh"
+#include "Trace.hh"
 
 using namespace XrdFileCache;
 
-void *PrefetchRunner(void * prefetch_void)
-{
-    Prefetch *prefetch = static_cast<Prefetch *>(prefetch_void);
-    if (prefetch)
-        prefetch->Run();
-    return NULL;
-}
-
 Cache *Cache::m_cache = NULL;
 XrdSysMutex Cache::m_cache_mutex;
 
 Cache::Cache(XrdOucCacheStats & stats, XrdSysError & log)
     : m_attached(0),
       m_log(log),
-      m_stats(stats),
-      m_cached_file(0),
-      m_read_from_disk(false)
+      m_stats(stats)
 {
 }
 
+/*
+ * m_io_mutex only covers the count of attached files: opens of different
+ * files, and the decision plugins they run, proceed in parallel.
+ */
 XrdOucCacheIO *
 Cache::Attach(XrdOucCacheIO *io, int Options)
 {
-    XrdSysMutexHelper lock(&m_io_mutex);
-    m_attached ++;
-
     if (io)
     {
-        m_log.Emsg("Attach", "Creating new IO object for file ", io->Path());
-
-        m_cached_file = Factory::GetInstance().GetOss()->newFile(Factory::GetInstance().GetUsername().c_str());
-        checkDiskCache(io);
+        {
+            XrdSysMutexHelper lock(&m_io_mutex);
+            m_attached ++;
+        }
 
-        PrefetchPtr prefetch;
-        if (!m_read_from_disk)
+        if (TRACE_ON(kInfo))
+            m_log.Emsg("Attach", "Creating new IO object for file ", io->Path());
+
+        // A file being filled already has a Prefetch, with its own handle
+        // on the data; attaching to it spares opening the info file.
+        PrefetchPtr prefetch = Factory::GetInstance().FindPrefetch(*io);
+        CachedFilePtr cached_file;
+        if (!prefetch)
+           cached_file = checkDiskCache(io);
+
+        // A partially cached file is completed through a Prefetch; the
+        // CachedFile is only kept if the decision plugins do not want the
+        // rest of the file.  The first pass through the Scheduler only
+        // opens the cache file; blocks are fetched as the client's access
+        // pattern asks for them.
+        if (!prefetch && (!cached_file || !cached_file->IsComplete()))
         {
            prefetch = Factory::GetInstance().GetPrefetch(*io);
-           pthread_t tid;
-           XrdSysThread::Run(&tid, PrefetchRunner, (void *)(prefetch.get()), 0, "XrdFileCache Prefetcher");
+           if (prefetch)
+              cached_file.reset();
+        }
+        if (prefetch)
+        {
+           prefetch->AddReader(io);
+           Factory::GetInstance().GetScheduler().Schedule(prefetch);
         }
 
-
-        return new IO(*io, m_stats, *this, prefetch, m_log);
-    }
-    else
-    {
-        m_attached --;
-        return NULL;
+        return new IO(*io, m_stats, *this, prefetch, cached_file, m_log);
     }
+    return NULL;
 }
 
 int 
@@ -73,8 +79,10 @@ Cache::isAttached()
 void
 Cache::Detach(XrdOucCacheIO* io)
 {
-    XrdSysMutexHelper lock(&m_io_mutex);
-    m_attached--;
+    {
+        XrdSysMutexHelper lock(&m_io_mutex);
+        m_attached--;
+    }
     delete io;
 }
 
@@ -96,16 +104,40 @@ Cache::getFilePathFromURL(const char* url, std::string &result)
    return true;
 }
 
-void
-Cache::checkDiskCache(XrdOucCacheIO* io)
+// Location of the data file in the cache, on the cache directory chosen
+// for it; its info file has Info::m_suffix appended.
+bool
+Cache::getCachePathFromURL(const char* url, std::string &result)
 {
-   XrdOucEnv myEnv;
-
    std::string fname;
-   getFilePathFromURL(io->Path(), fname);
-   fname = Factory::GetInstance().GetTempDirectory() + fname;
+   getFilePathFromURL(url, fname);
+   if (fname.empty())
+      return false;
+   return Factory::GetInstance().GetCacheDirs().Place(fname, result);
+}
 
-   int res =  m_cached_file->Open(fname.c_str(), O_RDONLY, 0600, myEnv);
-   if (res >= 0)
-      m_read_from_disk = true;
+/*
+ * Open the cached copy of a file, if there is one of the size the origin
+ * reports, complete or not.  Complete files share a handle through the
+ * Factory's FileTable.
+ */
+CachedFilePtr
+Cache::checkDiskCache(XrdOucCacheIO* io)
+{
+   std::string fname;
+   if (!getCachePathFromURL(io->Path(), fname))
+      return CachedFilePtr();
+
+   Factory::GetInstance().GetCatalog().Access(fname);
+   CachedFilePtr cached_file = Factory::GetInstance().GetFileTable().Get(fname);
+
+   // The file changed at the origin since it was cached; the Prefetch
+   // which fetches it anew re-initializes the info file.
+   if (cached_file && cached_file->GetInfo().GetFileSize() != io->FSize())
+   {
+      m_log.Emsg("Attach", "Cached size differs from the origin's for ", fname.c_str());
+      Factory::GetInstance().GetFileTable().Remove(fname);
+      cached_file.reset();
+   }
+   return cached_file;
 }
@@ -13,8 +13,6 @@
 
 #include "XrdFileCacheFwd.hh"
 
-class XrdOssDF;
-
 namespace XrdFileCache {
 
 class Cache : public XrdOucCache
@@ -31,14 +29,13 @@ public:
 
     virtual XrdOucCache* Create(XrdOucCache::Parms&, XrdOucCacheIO::aprParms*) {return NULL;}
    static bool getFilePathFromURL(const char* url, std::string& res);
+   static bool getCachePathFromURL(const char* url, std::string& res);
 
 protected:
 
     Cache(XrdOucCacheStats&, XrdSysError&);
 
-    void checkDiskCache(XrdOucCacheIO*);
-    XrdOssDF* getCachedFile() { return m_cached_file; }
-    bool readFromDisk() const { return m_read_from_disk; }
+    CachedFilePtr checkDiskCache(XrdOucCacheIO*);
 
 private:
 
@@ -53,10 +50,6 @@ private:
     XrdSysError & m_log;
     XrdOucCacheStats & m_stats;
 
-   XrdOssDF* m_cached_file;
-   bool      m_read_from_disk;
-
-
 };
 
 }
@@ -0,0 +1,157 @@
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <sys/statvfs.h>
+
+#include "XrdOss/XrdOss.hh"
+#include "XrdSys/XrdSysError.hh"
+
+#include "CacheDirs.hh"
+#include "Factory.hh"
+#include "Catalog.hh"
+
+using namespace XrdFileCache;
+
+namespace
+{
+// FNV-1a followed by a 64-bit finalizer; unlike std::tr1::hash it is the
+// same in every build, so files stay where they are across upgrades.
+unsigned long long
+Hash(const std::string &dir, const std::string &name)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < dir.size(); i++)
+        h = (h ^ static_cast<unsigned char>(dir[i])) * 1099511628211ULL;
+    h *= 1099511628211ULL; // a NUL between the two
+    for (size_t i = 0; i < name.size(); i++)
+        h = (h ^ static_cast<unsigned char>(name[i])) * 1099511628211ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+}
+
+CacheDirs::CacheDirs(XrdSysError &log)
+    : m_log(log)
+{
+}
+
+void
+CacheDirs::Add(const std::string &path, double weight)
+{
+    Dir dir;
+    dir.m_path = path;
+    while (dir.m_path.size() > 1 && dir.m_path[dir.m_path.size() - 1] == '/')
+        dir.m_path.erase(dir.m_path.size() - 1);
+    dir.m_weight = weight;
+    dir.m_in_service = true;
+    dir.m_in_flight = 0;
+    m_dirs.push_back(dir);
+}
+
+/*
+ * Missing directories are created.  Those whose file system cannot be
+ * looked at start out of service.  Weights are only worked out here, so
+ * later changes in free space do not move files around.
+ */
+bool
+CacheDirs::Init()
+{
+    bool any = false;
+    for (size_t i = 0; i < m_dirs.size(); i++)
+    {
+        long long total, used;
+        Factory::GetInstance().GetOss()->Mkdir(m_dirs[i].m_path.c_str(), 0700, 1);
+        if (!GetUsage(i, total, used))
+        {
+            m_dirs[i].m_in_service = false;
+            continue;
+        }
+        if (m_dirs[i].m_weight <= 0)
+            m_dirs[i].m_weight = total / (1024.0*1024*1024);
+        if (m_dirs[i].m_weight <= 0)
+            m_dirs[i].m_weight = 1;
+        any = true;
+    }
+    return any;
+}
+
+/*
+ * Weighted rendezvous hashing: the score is -weight / ln(u) for a hash u
+ * in (0, 1), which picks each directory with probability in proportion to
+ * its weight.
+ */
+bool
+CacheDirs::Place(const std::string &name, std::string &path) const
+{
+    int best = -1;
+    double best_score = 0;
+    for (size_t i = 0; i < m_dirs.size(); i++)
+    {
+        if (!InService(i))
+            continue;
+        double u = ((Hash(m_dirs[i].m_path, name) >> 11) + 0.5) / 9007199254740992.0;
+        double score = -m_dirs[i].m_weight / log(u);
+        if (best < 0 || score > best_score)
+        {
+            best = i;
+            best_score = score;
+        }
+    }
+    if (best < 0)
+        return false;
+    path = m_dirs[best].m_path + name;
+    return true;
+}
+
+int
+CacheDirs::Find(const std::string &path) const
+{
+    for (size_t i = 0; i < m_dirs.size(); i++)
+    {
+        const std::string &dir = m_dirs[i].m_path;
+        if (path.size() > dir.size() && path[dir.size()] == '/' && !path.compare(0, dir.size(), dir))
+            return i;
+    }
+    return -1;
+}
+
+void
+CacheDirs::ReportError(const std::string &path, int err)
+{
+    if (err < 0)
+        err = -err;
+    if (err != EIO && err != EROFS && err != ENODEV && err != ENXIO)
+        return;
+    int dir = Find(path);
+    if (dir >= 0)
+        Fail(dir, strerror(err));
+}
+
+void
+CacheDirs::Fail(int dir, const char *why)
+{
+    bool expected = true;
+    if (!__atomic_compare_exchange_n(&m_dirs[dir].m_in_service, &expected, false, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+    m_log.Emsg("CacheDirs", "Taking cache directory out of service:", m_dirs[dir].m_path.c_str(), why);
+    Factory::GetInstance().GetCatalog().RemoveUnder(m_dirs[dir].m_path + "/");
+}
+
+bool
+CacheDirs::GetUsage(int dir, long long &total, long long &used)
+{
+    struct statvfs fsstat;
+    if (statvfs(m_dirs[dir].m_path.c_str(), &fsstat) < 0)
+    {
+        m_log.Emsg("DiskUsage", errno, "statvfs cache directory", m_dirs[dir].m_path.c_str());
+        return false;
+    }
+    total = static_cast<long long>(fsstat.f_blocks) * fsstat.f_frsize;
+    used = total - static_cast<long long>(fsstat.f_bfree) * fsstat.f_frsize;
+    return true;
+}
@@ -0,0 +1,88 @@
+#ifndef __XRDFILECACHE_CACHEDIRS_HH__
+#define __XRDFILECACHE_CACHEDIRS_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * The directories the cache is spread over, typically one per disk.
+ *
+ * Each file lives in exactly one directory, chosen by weighted rendezvous
+ * hashing of its name: every directory in service scores the name and the
+ * highest score wins.  The choice only depends on the name and the set of
+ * directories, so a lookup goes straight to one directory, and taking a
+ * directory out of service only moves the files that were on it.  A
+ * directory with twice the weight gets twice the files; by default the
+ * weight is the size of its file system.
+ *
+ * A directory whose disk returns hard I/O errors is taken out of service
+ * for the life of the process.  Its files are dropped from the catalog and
+ * land on the remaining directories as they are read again.
+ */
+
+#include <string>
+#include <vector>
+
+class XrdSysError;
+
+namespace XrdFileCache {
+
+class CacheDirs
+{
+
+public:
+
+    CacheDirs(XrdSysError &);
+
+    // weight 0 means in proportion to the capacity of the file system.
+    void Add(const std::string &path, double weight);
+
+    // Work out capacity weights; false if no directory is usable.
+    bool Init();
+
+    bool IsEmpty() const {return m_dirs.empty();}
+    int GetNumDirs() const {return m_dirs.size();}
+    const std::string &GetPath(int dir) const {return m_dirs[dir].m_path;}
+    double GetWeight(int dir) const {return m_dirs[dir].m_weight;}
+    bool InService(int dir) const {return __atomic_load_n(&m_dirs[dir].m_in_service, __ATOMIC_ACQUIRE);}
+
+    // The cache path of name on the directory chosen for it; false if no
+    // directory is in service.
+    bool Place(const std::string &name, std::string &path) const;
+
+    // The directory holding a cache path, or -1.
+    int Find(const std::string &path) const;
+
+    // Take the directory holding path out of service if err means its
+    // disk has failed, rather than that it is full or the file is gone.
+    void ReportError(const std::string &path, int err);
+    void Fail(int dir, const char *why);
+
+    bool GetUsage(int dir, long long &total, long long &used);
+
+    // Prefetch fetches writing to the directory right now.
+    void AddInFlight(int dir, int delta) {if (dir >= 0) __sync_fetch_and_add(&m_dirs[dir].m_in_flight, delta);}
+    int GetInFlight(int dir) const {return (dir >= 0) ? __atomic_load_n(&m_dirs[dir].m_in_flight, __ATOMIC_RELAXED) : 0;}
+
+private:
+
+    struct Dir
+    {
+        std::string m_path;
+        double m_weight;
+        bool m_in_service;
+        int m_in_flight;
+    };
+
+    // Fixed once configuration is over; only the flags and counters change.
+    std::vector<Dir> m_dirs;
+    XrdSysError & m_log;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,175 @@
+
+#include <fcntl.h>
+#include <memory>
+#include <algorithm>
+#include <sstream>
+
+#include "XrdOss/XrdOss.hh"
+#include "XrdOuc/XrdOucEnv.hh"
+#include "XrdSys/XrdSysError.hh"
+
+#include "CachedFile.hh"
+#include "Factory.hh"
+#include "DirectIO.hh"
+#include "Crc32c.hh"
+#include "BufferPool.hh"
+#include "Statistics.hh"
+#include "FileTable.hh"
+#include "Catalog.hh"
+
+using namespace XrdFileCache;
+
+CachedFile::CachedFile(XrdSysError &log)
+    : m_file(NULL),
+      m_direct(false),
+      m_log(log)
+{
+}
+
+CachedFile::~CachedFile()
+{
+    if (m_file)
+    {
+        m_file->Close();
+        delete m_file;
+    }
+}
+
+bool
+CachedFile::Open(XrdOss &oss, const std::string &path)
+{
+    XrdOucEnv myEnv;
+    const char *username = Factory::GetInstance().GetUsername().c_str();
+    m_path = path;
+
+    std::string iname = path + Info::m_suffix;
+    std::auto_ptr<XrdOssDF> infoFile(oss.newFile(username));
+    if (infoFile->Open(iname.c_str(), O_RDONLY, 0600, myEnv) < 0)
+       return false;
+    bool valid = m_info.Read(infoFile.get());
+    infoFile->Close();
+    if (!valid)
+       return false;
+
+    // Direct reads bounce through aligned buffers, so one handle does for
+    // reads of any shape.
+    m_direct = Factory::GetInstance().GetDirectRead();
+    m_file = oss.newFile(username);
+    if (m_direct && m_file->Open(path.c_str(), O_RDONLY | DirectIO::OpenFlag(), 0600, myEnv) >= 0)
+       return true;
+    m_direct = false;
+    if (m_file->Open(path.c_str(), O_RDONLY, 0600, myEnv) < 0)
+    {
+       delete m_file;
+       m_file = NULL;
+       return false;
+    }
+    return true;
+}
+
+ssize_t
+CachedFile::Read(char *buff, off_t offset, size_t size)
+{
+    if (!m_file)
+    {
+        errno = EBADF;
+        return -errno;
+    }
+
+    long long available = offset + CachedRun(offset, size);
+    if (available <= offset)
+        return 0;
+    ssize_t retval;
+    if (m_direct)
+        retval = DirectIO::Read(m_file, buff, offset, available - offset);
+    else
+        retval = m_file->Read(buff, offset, available - offset);
+    if (retval < 0)
+        Factory::GetInstance().GetCacheDirs().ReportError(m_path, retval);
+    return retval;
+}
+
+/*
+ * See Prefetch::VerifyRun.
+ */
+long long
+CachedFile::CachedRun(off_t offset, size_t size)
+{
+    long long run = m_info.GetCachedRun(offset, size);
+    if (run <= 0 || !m_file || !Factory::GetInstance().GetVerify())
+        return run;
+    long long blockSize = m_info.GetBlockSize();
+    int last = (offset + run - 1) / blockSize;
+    for (int block = offset / blockSize; block <= last; block++)
+    {
+        if (!m_info.TestVerified(block) && !VerifyBlock(block))
+            return std::max(0LL, block * blockSize - offset);
+    }
+    return run;
+}
+
+bool
+CachedFile::VerifyBlock(int block)
+{
+    off_t offset = block * m_info.GetBlockSize();
+    long long length = m_info.GetBlockLength(block);
+    BufferPool::Buffer buff(length);
+    ssize_t retval;
+    if (m_direct)
+        retval = DirectIO::Read(m_file, buff.Get(), offset, length);
+    else
+        retval = m_file->Read(buff.Get(), offset, length);
+    if (retval == length && Crc32c::Compute(buff.Get(), length) == m_info.GetChecksum(block))
+    {
+        m_info.SetVerified(block);
+        Factory::GetInstance().GetStatistics().Add(Statistics::kBytesVerified, length);
+        return true;
+    }
+    if (retval < 0)
+        Factory::GetInstance().GetCacheDirs().ReportError(m_path, retval);
+    DropBadBlock(block);
+    return false;
+}
+
+/*
+ * Clients already attached read the block from the origin from now on.
+ * The handle is dropped from the FileTable, as the file is no longer
+ * complete.
+ */
+void
+CachedFile::DropBadBlock(int block)
+{
+    XrdSysMutexHelper lock(&m_mutex);
+    if (!m_info.TestBlock(block))
+        return;
+    std::stringstream ss;
+    ss << "Block " << block << " failed its checksum; dropping it";
+    m_log.Emsg("Verify", ss.str().c_str(), " from ", m_path.c_str());
+    Factory::GetInstance().GetStatistics().Add(Statistics::kBadBlocks, 1);
+    m_info.ClearBlockPresent(block);
+
+    XrdOucEnv myEnv;
+    std::string iname = m_path + Info::m_suffix;
+    std::auto_ptr<XrdOssDF> infoFile(Factory::GetInstance().GetOss()->newFile(Factory::GetInstance().GetUsername().c_str()));
+    if (infoFile->Open(iname.c_str(), O_RDWR, 0600, myEnv) < 0 || !m_info.Write(infoFile.get()))
+        m_log.Emsg("Verify", errno, "update info file", iname.c_str());
+    infoFile->Close();
+
+    Factory::GetInstance().GetFileTable().Remove(m_path);
+    Factory::GetInstance().GetCatalog().Update(m_path, m_file, m_info.GetBytesPresent(), m_info.IsComplete());
+}
+
+#if defined(HAVE_READV)
+ssize_t
+CachedFile::ReadV(XrdOucIOVec *readV, int n)
+{
+    if (!m_file)
+    {
+        errno = EBADF;
+        return -errno;
+    }
+    if (m_direct)
+        return DirectIO::ReadV(m_file, readV, n);
+    return m_file->ReadV(readV, n);
+}
+#endif
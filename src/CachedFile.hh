@@ -0,0 +1,75 @@
+#ifndef __XRDFILECACHE_CACHEDFILE_HH__
+#define __XRDFILECACHE_CACHEDFILE_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * A file already present in the disk cache, opened when a client attaches.
+ * Its data is only read, never written; data still being fetched goes
+ * through a Prefetch object instead.  A block which fails its checksum is
+ * dropped from the info file, so that the next client to open the file
+ * gets a Prefetch which fetches it again.
+ */
+
+#include <string>
+
+#include <XrdOuc/XrdOucIOVec.hh>
+#include <XrdSys/XrdSysPthread.hh>
+
+#include "Info.hh"
+
+class XrdOss;
+class XrdOssDF;
+class XrdSysError;
+
+namespace XrdFileCache {
+
+class CachedFile
+{
+
+public:
+
+    CachedFile(XrdSysError &);
+    ~CachedFile();
+
+    // Open the data file at path and load its info file.  Returns false if
+    // either is missing or the info file is invalid.
+    bool Open(XrdOss &, const std::string &path);
+
+    // Read the run of present blocks starting at offset; returns 0 if the
+    // block at offset is not in the cache.
+    ssize_t Read(char *buff, off_t offset, size_t size);
+
+    // Length of the run of present bytes at offset; see Info::GetCachedRun.
+    // Blocks not yet checked against their checksum are checked first.
+    long long CachedRun(off_t offset, size_t size);
+
+#if defined(HAVE_READV)
+    // Vectored read of ranges already checked with CachedRun.
+    ssize_t ReadV(XrdOucIOVec *readV, int n);
+#endif
+
+    bool IsComplete() const {return m_info.IsComplete();}
+    const Info &GetInfo() const {return m_info;}
+
+private:
+
+    bool VerifyBlock(int block);
+    void DropBadBlock(int block);
+
+    std::string m_path;
+    XrdSysMutex m_mutex; // serializes DropBadBlock
+    XrdOssDF *m_file;
+    bool m_direct;
+    Info m_info;
+    XrdSysError & m_log;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,244 @@
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <memory>
+#include <sstream>
+
+#include "XrdOss/XrdOss.hh"
+#include "XrdOuc/XrdOucEnv.hh"
+#include "XrdSys/XrdSysError.hh"
+
+#include "Catalog.hh"
+#include "Factory.hh"
+
+using namespace XrdFileCache;
+
+namespace
+{
+bool OlderAccess(const Catalog::Record &a, const Catalog::Record &b)
+{
+    return a.m_access < b.m_access;
+}
+}
+
+Catalog::Catalog(XrdSysError &log)
+    : m_total_bytes(0),
+      m_dirty(false),
+      m_log(log)
+{
+}
+
+void
+Catalog::Update(const std::string &path, long long bytes, bool complete)
+{
+    XrdSysMutexHelper lock(&m_mutex);
+    EntryMap::iterator it = m_entries.find(path);
+    if (it == m_entries.end())
+    {
+        Entry entry;
+        entry.m_bytes = 0;
+        entry.m_access = time(0);
+        entry.m_complete = false;
+        it = m_entries.insert(EntryMap::value_type(path, entry)).first;
+    }
+    m_total_bytes += bytes - it->second.m_bytes;
+    it->second.m_bytes = bytes;
+    it->second.m_complete = complete;
+    m_dirty = true;
+}
+
+void
+Catalog::Update(const std::string &path, XrdOssDF *data, long long bytes, bool complete)
+{
+    struct stat st;
+    if (data && data->Fstat(&st) == 0)
+        bytes = st.st_blocks * 512LL;
+    Update(path, bytes, complete);
+}
+
+void
+Catalog::Access(const std::string &path)
+{
+    XrdSysMutexHelper lock(&m_mutex);
+    EntryMap::iterator it = m_entries.find(path);
+    if (it == m_entries.end())
+        return;
+    it->second.m_access = time(0);
+    m_dirty = true;
+}
+
+void
+Catalog::Remove(const std::string &path)
+{
+    XrdSysMutexHelper lock(&m_mutex);
+    EntryMap::iterator it = m_entries.find(path);
+    if (it == m_entries.end())
+        return;
+    m_total_bytes -= it->second.m_bytes;
+    m_entries.erase(it);
+    m_dirty = true;
+}
+
+void
+Catalog::RemoveUnder(const std::string &prefix)
+{
+    XrdSysMutexHelper lock(&m_mutex);
+    for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); )
+    {
+        if (it->first.compare(0, prefix.size(), prefix))
+        {
+            ++it;
+            continue;
+        }
+        m_total_bytes -= it->second.m_bytes;
+        m_entries.erase(it++);
+        m_dirty = true;
+    }
+}
+
+void
+Catalog::Clear()
+{
+    XrdSysMutexHelper lock(&m_mutex);
+    m_entries.clear();
+    m_total_bytes = 0;
+    m_dirty = true;
+}
+
+void
+Catalog::GetByAccess(std::vector<Record> &records)
+{
+    {
+        XrdSysMutexHelper lock(&m_mutex);
+        records.reserve(m_entries.size());
+        for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+        {
+            Record record;
+            record.m_path = it->first;
+            record.m_bytes = it->second.m_bytes;
+            record.m_access = it->second.m_access;
+            record.m_complete = it->second.m_complete;
+            records.push_back(record);
+        }
+    }
+    std::sort(records.begin(), records.end(), OlderAccess);
+}
+
+long long
+Catalog::GetTotalBytes()
+{
+    XrdSysMutexHelper lock(&m_mutex);
+    return m_total_bytes;
+}
+
+int
+Catalog::GetNumFiles()
+{
+    XrdSysMutexHelper lock(&m_mutex);
+    return m_entries.size();
+}
+
+/*
+ * Checkpoint format: one line per file,
+ *
+ *   <access time> <bytes> <complete> <path>
+ *
+ * The path is the rest of the line so that it may contain spaces.
+ */
+bool
+Catalog::Load(XrdOss &oss, const std::string &path)
+{
+    XrdOucEnv myEnv;
+    std::auto_ptr<XrdOssDF> fp(oss.newFile(Factory::GetInstance().GetUsername().c_str()));
+    if (fp->Open(path.c_str(), O_RDONLY, 0600, myEnv) < 0)
+        return false;
+
+    std::string contents;
+    char buff[64*1024];
+    ssize_t retval;
+    off_t off = 0;
+    while ((retval = fp->Read(buff, off, sizeof(buff))) > 0)
+    {
+        contents.append(buff, retval);
+        off += retval;
+    }
+    fp->Close();
+    if (retval < 0)
+    {
+        m_log.Emsg("Catalog", retval, "read checkpoint", path.c_str());
+        return false;
+    }
+
+    XrdSysMutexHelper lock(&m_mutex);
+    m_entries.clear();
+    m_total_bytes = 0;
+    std::istringstream is(contents);
+    std::string line;
+    while (std::getline(is, line))
+    {
+        long access, complete;
+        long long bytes;
+        int consumed;
+        if (sscanf(line.c_str(), "%ld %lld %ld %n", &access, &bytes, &complete, &consumed) != 3 || !line[consumed])
+        {
+            m_log.Emsg("Catalog", "Ignoring malformed checkpoint line in", path.c_str());
+            continue;
+        }
+        Entry entry;
+        entry.m_access = access;
+        entry.m_bytes = bytes;
+        entry.m_complete = complete;
+        m_entries[line.substr(consumed)] = entry;
+        m_total_bytes += bytes;
+    }
+    m_dirty = false;
+    return true;
+}
+
+/*
+ * Write the catalog next to path and rename it into place, so a crash
+ * leaves either the old or the new checkpoint.  Nothing is written if the
+ * catalog has not changed since the last checkpoint.
+ */
+bool
+Catalog::Checkpoint(XrdOss &oss, const std::string &path)
+{
+    std::ostringstream os;
+    {
+        XrdSysMutexHelper lock(&m_mutex);
+        if (!m_dirty)
+            return true;
+        for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+            os << static_cast<long>(it->second.m_access) << " " << it->second.m_bytes << " "
+               << (it->second.m_complete ? 1 : 0) << " " << it->first << "\n";
+        m_dirty = false;
+    }
+    std::string contents = os.str();
+
+    XrdOucEnv myEnv;
+    const char *username = Factory::GetInstance().GetUsername().c_str();
+    std::string tmp_path = path + ".tmp";
+    oss.Unlink(tmp_path.c_str());
+    oss.Create(username, tmp_path.c_str(), 0600, myEnv, XRDOSS_mkpath);
+    std::auto_ptr<XrdOssDF> fp(oss.newFile(username));
+    bool ok = fp->Open(tmp_path.c_str(), O_WRONLY, 0600, myEnv) >= 0;
+    size_t written = 0;
+    while (ok && written < contents.size())
+    {
+        ssize_t retval = fp->Write(contents.data() + written, written, contents.size() - written);
+        if (retval < 0 && errno == EINTR) continue;
+        if (retval < 0) ok = false;
+        else written += retval;
+    }
+    if (ok) fp->Close();
+    if (!ok || oss.Rename(tmp_path.c_str(), path.c_str()) < 0)
+    {
+        m_log.Emsg("Catalog", errno, "write checkpoint", path.c_str());
+        XrdSysMutexHelper lock(&m_mutex);
+        m_dirty = true;
+        return false;
+    }
+    return true;
+}
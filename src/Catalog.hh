@@ -0,0 +1,90 @@
+#ifndef __XRDFILECACHE_CATALOG_HH__
+#define __XRDFILECACHE_CATALOG_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * In-memory list of the files in the cache, kept up to date by Prefetch
+ * and IO so that eviction and reporting never have to walk the cache
+ * directory.  It is checkpointed to a file in the cache directory and
+ * reloaded from there on startup.
+ */
+
+#include <string>
+#include <vector>
+
+#include <XrdSys/XrdSysPthread.hh>
+
+#include "XrdFileCacheFwd.hh"
+
+class XrdOss;
+class XrdOssDF;
+class XrdSysError;
+
+namespace XrdFileCache {
+
+class Catalog
+{
+
+public:
+
+    struct Record
+    {
+        std::string m_path;
+        long long m_bytes;   // bytes the file takes up on the cache disk
+        time_t m_access;     // last time a client attached or detached
+        bool m_complete;
+    };
+
+    Catalog(XrdSysError &);
+
+    // Add or update the file at path.
+    void Update(const std::string &path, long long bytes, bool complete);
+
+    // As Update, with the space the open data file takes on disk; bytes
+    // is only used if the file cannot be looked at.
+    void Update(const std::string &path, XrdOssDF *data, long long bytes, bool complete);
+
+    // Record a client access to a file already in the catalog.
+    void Access(const std::string &path);
+
+    void Remove(const std::string &path);
+
+    // Remove every file whose path starts with prefix.
+    void RemoveUnder(const std::string &prefix);
+    void Clear();
+
+    // All files, least recently accessed first.
+    void GetByAccess(std::vector<Record> &);
+
+    long long GetTotalBytes();
+    int GetNumFiles();
+
+    bool Load(XrdOss &, const std::string &path);
+    bool Checkpoint(XrdOss &, const std::string &path);
+
+private:
+
+    struct Entry
+    {
+        long long m_bytes;
+        time_t m_access;
+        bool m_complete;
+    };
+    typedef std::tr1::unordered_map<std::string, Entry> EntryMap;
+
+    XrdSysMutex m_mutex;
+    EntryMap m_entries;
+    long long m_total_bytes;
+    bool m_dirty;
+    XrdSysError & m_log;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,117 @@
+
+#include <string.h>
+
+#include "Crc32c.hh"
+
+using namespace XrdFileCache;
+
+namespace
+{
+// Reflected Castagnoli polynomial.
+const unsigned int poly = 0x82f63b78;
+
+/*
+ * Slicing-by-8 tables: table[0] is the usual byte-at-a-time table and
+ * table[k][b] is the CRC of byte b followed by k zero bytes.  Built once
+ * at load time, before any thread can use them.
+ */
+struct Tables
+{
+    unsigned int m_table[8][256];
+
+    Tables()
+    {
+        for (unsigned int b = 0; b < 256; b++)
+        {
+            unsigned int crc = b;
+            for (int i = 0; i < 8; i++)
+                crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+            m_table[0][b] = crc;
+        }
+        for (unsigned int b = 0; b < 256; b++)
+            for (int k = 1; k < 8; k++)
+                m_table[k][b] = (m_table[k-1][b] >> 8) ^ m_table[0][m_table[k-1][b] & 0xff];
+    }
+};
+
+const Tables g_tables;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+unsigned int
+ComputeHardware(const unsigned char *p, size_t size, unsigned int crc)
+{
+    unsigned long long crc64 = crc;
+    while (size && (reinterpret_cast<unsigned long>(p) & 7))
+    {
+        crc64 = __builtin_ia32_crc32qi(crc64, *p++);
+        size--;
+    }
+    while (size >= 8)
+    {
+        unsigned long long word;
+        memcpy(&word, p, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+        p += 8;
+        size -= 8;
+    }
+    crc = crc64;
+    while (size--)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+
+bool
+DetectHardware()
+{
+    // Static initializers may run before libgcc has probed the CPU.
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+const bool g_hardware = DetectHardware();
+#else
+const bool g_hardware = false;
+#endif
+}
+
+bool
+Crc32c::HasHardware()
+{
+    return g_hardware;
+}
+
+unsigned int
+Crc32c::Compute(const void *data, size_t size, unsigned int crc)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (g_hardware)
+        return ~ComputeHardware(static_cast<const unsigned char *>(data), size, ~crc);
+#endif
+    return ComputeSoftware(data, size, crc);
+}
+
+// Little-endian word loads; big-endian hosts go byte by byte.
+unsigned int
+Crc32c::ComputeSoftware(const void *data, size_t size, unsigned int crc)
+{
+    const unsigned int (*t)[256] = g_tables.m_table;
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    while (size >= 8)
+    {
+        unsigned int lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+#endif
+    while (size--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    return ~crc;
+}
@@ -0,0 +1,36 @@
+#ifndef __XRDFILECACHE_CRC32C_HH__
+#define __XRDFILECACHE_CRC32C_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * CRC32C (Castagnoli), used to checksum cache blocks.  On x86-64 CPUs with
+ * SSE4.2 the crc32 instruction is used; elsewhere a table-driven version
+ * which handles eight bytes per step.  Both give the same results.
+ */
+
+#include <stddef.h>
+
+namespace XrdFileCache {
+
+namespace Crc32c {
+
+// Checksum of size bytes at data.  To checksum data in pieces, pass the
+// result for the preceding pieces as crc; start from 0.
+unsigned int Compute(const void *data, size_t size, unsigned int crc = 0);
+
+// Whether Compute uses the hardware instruction on this machine.
+bool HasHardware();
+
+// The table-driven version, whatever the machine supports.
+unsigned int ComputeSoftware(const void *data, size_t size, unsigned int crc = 0);
+
+}
+
+}
+
+#endif
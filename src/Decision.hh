@@ -15,5 +15,40 @@ public:
 
 };
 
+/*
+ * Extended decision interface.  Plugins which derive from Decision2 are
+ * found with dynamic_cast when loaded; those built against Decision alone
+ * keep working, binary and all, and get the defaults below.  Decision
+ * itself must not change layout.
+ */
+class Decision2 : public Decision {
+
+public:
+
+    // As Decide, for a file whose size is known; size is -1 if it is not.
+    // The default ignores the size.
+    virtual bool DecideFile(std::string &path, long long size, XrdOss &oss) const {return Decide(path, oss);}
+
+    // Called once with whatever followed the library name on the
+    // decisionlib directive; returning false fails the configuration.
+    virtual bool ConfigDecision(const char *parms) {return true;}
+
+    // How many seconds a verdict on a path may be reused without asking
+    // again: -1 for the filecache.decisionttl default, 0 for never.  A
+    // plugin whose verdict changes from one open to the next returns 0.
+    virtual int GetCacheTime() const {return -1;}
+
+    // If the verdict on path holds for every file under a directory, set
+    // prefix to that directory, ending in '/', and return true.
+    virtual bool GetVerdictScope(const std::string &path, std::string &prefix) const {return false;}
+
+    // For a file the chain admits: whether to cache only the blocks
+    // clients read, plus a bounded readahead, instead of the whole file.
+    // Covered by the same cache time and scope as the verdict.  Files at
+    // or above the filecache.sparse size are sparse regardless.
+    virtual bool DecideSparse(const std::string &path, long long size) const {return false;}
+
+};
+
 }
 
@@ -0,0 +1,98 @@
+
+#include <time.h>
+
+#include "DecisionCache.hh"
+
+using namespace XrdFileCache;
+
+const int DecisionCache::m_num_shards = 16;
+
+// Bounds the memory used by a scan over a huge namespace; a shard which
+// outgrows it drops its expired entries, and then everything if need be.
+const size_t DecisionCache::m_max_shard_entries = 64 * 1024;
+
+DecisionCache::DecisionCache()
+    : m_shards(new Shard[m_num_shards])
+{
+}
+
+DecisionCache::~DecisionCache()
+{
+    delete [] m_shards;
+}
+
+bool
+DecisionCache::Lookup(const std::string &key, time_t now, bool &verdict, bool &sparse)
+{
+    Shard &shard = GetShard(key);
+    XrdSysMutexHelper lock(&shard.m_mutex);
+    EntryMap::iterator it = shard.m_entries.find(key);
+    if (it == shard.m_entries.end())
+        return false;
+    if (it->second.m_expires <= now)
+    {
+        shard.m_entries.erase(it);
+        return false;
+    }
+    verdict = it->second.m_verdict;
+    sparse = it->second.m_sparse;
+    return true;
+}
+
+/*
+ * The path itself first, then its directories from the deepest up.  Only
+ * the part before any query string counts.
+ */
+bool
+DecisionCache::Get(const std::string &path, bool &verdict, bool &sparse)
+{
+    time_t now = time(0);
+    if (Lookup(path, now, verdict, sparse))
+        return true;
+
+    size_t end = path.find('?');
+    if (end == std::string::npos)
+        end = path.size();
+    while (end > 0 && (end = path.rfind('/', end - 1)) != std::string::npos)
+    {
+        if (Lookup(path.substr(0, end + 1), now, verdict, sparse))
+            return true;
+    }
+    return false;
+}
+
+void
+DecisionCache::Put(const std::string &key, bool verdict, bool sparse, int ttl)
+{
+    if (ttl <= 0)
+        return;
+    time_t now = time(0);
+    Shard &shard = GetShard(key);
+    XrdSysMutexHelper lock(&shard.m_mutex);
+    if (shard.m_entries.size() >= m_max_shard_entries)
+    {
+        for (EntryMap::iterator it = shard.m_entries.begin(); it != shard.m_entries.end(); )
+        {
+            if (it->second.m_expires <= now)
+                shard.m_entries.erase(it++);
+            else
+                ++it;
+        }
+        if (shard.m_entries.size() >= m_max_shard_entries)
+            shard.m_entries.clear();
+    }
+    Entry &entry = shard.m_entries[key];
+    entry.m_verdict = verdict;
+    entry.m_sparse = sparse;
+    entry.m_expires = now + ttl;
+}
+
+void
+DecisionCache::Clear()
+{
+    for (int i = 0; i < m_num_shards; i++)
+    {
+        XrdSysMutexHelper lock(&m_shards[i].m_mutex);
+        m_shards[i].m_entries.clear();
+    }
+}
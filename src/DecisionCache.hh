@@ -0,0 +1,76 @@
+#ifndef __XRDFILECACHE_DECISIONCACHE_HH__
+#define __XRDFILECACHE_DECISIONCACHE_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * Verdicts of the decision plugin chain, remembered for a while so that a
+ * burst of opens of the same files, or of files in the same directory,
+ * does not run the chain for each of them.  A verdict is kept either for
+ * one path or, when every plugin which gave it says it holds for a whole
+ * directory, for every path below that directory.  Along with the verdict
+ * goes whether the plugins asked for the file to be cached sparsely.
+ *
+ * Entries are spread over independently locked shards by key; a lookup
+ * takes one shard lock per candidate key and never holds two at once.
+ */
+
+#include <string>
+
+#include <XrdSys/XrdSysPthread.hh>
+
+#include "XrdFileCacheFwd.hh"
+
+namespace XrdFileCache {
+
+class DecisionCache
+{
+
+public:
+
+    DecisionCache();
+    ~DecisionCache();
+
+    // Find a live verdict for path, held for the path itself or for one of
+    // the directories it is in.
+    bool Get(const std::string &path, bool &verdict, bool &sparse);
+
+    // Remember a verdict for ttl seconds under key, which is a path or,
+    // for a directory-wide verdict, a directory ending in '/'.
+    void Put(const std::string &key, bool verdict, bool sparse, int ttl);
+
+    void Clear();
+
+private:
+
+    struct Entry
+    {
+        bool m_verdict;
+        bool m_sparse;
+        time_t m_expires;
+    };
+    typedef std::tr1::unordered_map<std::string, Entry> EntryMap;
+
+    struct Shard
+    {
+        XrdSysMutex m_mutex;
+        EntryMap m_entries;
+    };
+
+    Shard &GetShard(const std::string &key) {return m_shards[std::tr1::hash<std::string>()(key) % m_num_shards];}
+    bool Lookup(const std::string &key, time_t now, bool &verdict, bool &sparse);
+
+    static const int m_num_shards;
+    static const size_t m_max_shard_entries;
+
+    Shard *m_shards;
+
+};
+
+}
+
+#endif
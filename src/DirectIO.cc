@@ -0,0 +1,77 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <algorithm>
+
+#include "XrdOss/XrdOss.hh"
+#if defined(HAVE_READV)
+#include "XrdOuc/XrdOucIOVec.hh"
+#endif
+
+#include "DirectIO.hh"
+#include "BufferPool.hh"
+
+using namespace XrdFileCache;
+
+int
+DirectIO::OpenFlag()
+{
+#if defined(O_DIRECT)
+    return O_DIRECT;
+#else
+    return 0;
+#endif
+}
+
+bool
+DirectIO::IsAligned(const void *buff, off_t offset, size_t size)
+{
+    return (reinterpret_cast<unsigned long>(buff) % kAlignment) == 0 &&
+           (offset % kAlignment) == 0 && (size % kAlignment) == 0;
+}
+
+ssize_t
+DirectIO::Read(XrdOssDF *fp, char *buff, off_t offset, size_t size)
+{
+    if (!size)
+        return 0;
+    if (IsAligned(buff, offset, size))
+        return fp->Read(buff, offset, size);
+
+    off_t aligned_offset = offset - (offset % kAlignment);
+    size_t aligned_size = ((offset + size - aligned_offset + kAlignment - 1) / kAlignment) * kAlignment;
+    BufferPool::Buffer bounce(aligned_size);
+    ssize_t retval;
+    while ((retval = fp->Read(bounce.Get(), aligned_offset, aligned_size)) < 0 && errno == EINTR)
+        ;
+    if (retval < 0)
+        return retval;
+    long long skip = offset - aligned_offset;
+    if (retval <= skip)
+        return 0;
+    size_t copied = std::min(static_cast<size_t>(retval - skip), size);
+    memcpy(buff, bounce.Get() + skip, copied);
+    return copied;
+}
+
+#if defined(HAVE_READV)
+ssize_t
+DirectIO::ReadV(XrdOssDF *fp, XrdOucIOVec *readV, int n)
+{
+    ssize_t total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        ssize_t retval = Read(fp, readV[i].data, readV[i].offset, readV[i].size);
+        if (retval < 0)
+            return retval;
+        if (retval != readV[i].size)
+        {
+            errno = EIO;
+            return -errno;
+        }
+        total += retval;
+    }
+    return total;
+}
+#endif
@@ -0,0 +1,48 @@
+#ifndef __XRDFILECACHE_DIRECTIO_HH__
+#define __XRDFILECACHE_DIRECTIO_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * Helpers for cache files opened with O_DIRECT, which bypasses the page
+ * cache but needs the buffer, offset and length of every transfer to be
+ * aligned.  Writes which are not aligned, in practice only the tail block
+ * of a file, must go through a buffered handle instead; reads of any
+ * shape are bounced through an aligned buffer from the pool.
+ */
+
+#include <sys/types.h>
+
+class XrdOssDF;
+struct XrdOucIOVec;
+
+namespace XrdFileCache {
+
+namespace DirectIO {
+
+const long long kAlignment = 4096;
+
+// Extra open flag for a direct handle; 0 where O_DIRECT is unsupported.
+int OpenFlag();
+
+bool IsAligned(const void *buff, off_t offset, size_t size);
+
+// Read size bytes at offset through an aligned bounce buffer.  Returns
+// the bytes copied out, short only at the end of the file.
+ssize_t Read(XrdOssDF *fp, char *buff, off_t offset, size_t size);
+
+#if defined(HAVE_READV)
+// Each chunk is read on its own with Read; the chunks are expected to be
+// the already coalesced ranges of a cache readv.
+ssize_t ReadV(XrdOssDF *fp, XrdOucIOVec *readV, int n);
+#endif
+
+}
+
+}
+
+#endif
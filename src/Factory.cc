@@ -1,10 +1,13 @@
 #include <sstream>
 #include <fcntl.h>
 #include <stdio.h>
+#include <algorithm>
+#include <memory>
 
 #include "XrdSys/XrdSysPthread.hh"
 #include "XrdOuc/XrdOucEnv.hh"
 #include "XrdOuc/XrdOucStream.hh"
+#include "XrdOuc/XrdOuca2x.hh"
 #include "XrdOss/XrdOss.hh"
 #if !defined(HAVE_VERSIONS)
 #include "XrdOss/XrdOssApi.hh"
@@ -16,11 +19,12 @@
 #include "Factory.hh"
 #include "Prefetch.hh"
 #include "Decision.hh"
-
-namespace 
-{
-static  int max_temp_dir_age = 86400 *2; // e.g. check temp dir every 2 days
-}
+#include "Info.hh"
+#include "Catalog.hh"
+#include "Trace.hh"
+#include "BufferPool.hh"
+#include "DirectIO.hh"
+#include "Statistics.hh"
 
 using namespace XrdFileCache;
 
@@ -80,14 +84,18 @@ Factory * Factory::m_factory = NULL;
 XrdSysMutex Factory::m_factory_mutex;
 
 
+/*
+ * Add every data file below path to the catalog.  Only used when there is
+ * no usable checkpoint.
+ */
 void Factory::CheckDirStatRecurse( XrdOssDF* df, std::string& path)
 {   
-   char buff[256];
+   char buff[4096];
    XrdOucEnv env;
    struct stat st;
    int  rdr;
-   //  std::cerr << "CheckDirStatRecurse " << path << std::endl;
-   while ( (rdr = df->Readdir(&buff[0], 256)) >= 0)
+   size_t suffix_len = strlen(Info::m_suffix);
+   while ( (rdr = df->Readdir(&buff[0], sizeof(buff))) >= 0)
    {
       std::string np = path + "/" + std::string(buff); 
       if ( strlen(&buff[0]) == 0  )
@@ -100,39 +108,176 @@ void Factory::CheckDirStatRecurse( XrdOssDF* df, std::string& path)
       if (strncmp("..", &buff[0], 2) && strncmp(".", &buff[0], 1))
       {
          std::auto_ptr<XrdOssDF> dh(m_output_fs->newDir(m_username.c_str()));
-         std::auto_ptr<XrdOssDF> fh(m_output_fs->newFile(m_username.c_str()));
-         // std::cerr << "!!!!!! " << np << std::endl;
          if ( dh->Opendir(np.c_str(), env)  >= 0 )
          {
             CheckDirStatRecurse(dh.get(), np);
+            dh->Close();
          }
-         else if ( fh->Open(np.c_str(),O_RDONLY, 0600, env) >= 0)
+         else if ( (np.size() <= suffix_len || np.compare(np.size() - suffix_len, suffix_len, Info::m_suffix)) &&
+                   m_output_fs->Stat(np.c_str(), &st) == 0 )
          {
-            fh->Fstat(&st);
-            if ( time(0) - st.st_mtime > max_temp_dir_age )
+            // Data files only; info files go with their data file.  Sizes
+            // are what the file takes on disk, holes and all.
+            long long bytes = st.st_blocks * 512LL;
+            bool complete = false;
+            std::auto_ptr<XrdOssDF> fh(m_output_fs->newFile(m_username.c_str()));
+            if (fh->Open((np + Info::m_suffix).c_str(), O_RDONLY, 0600, env) >= 0)
             {
-               // printf("\n!!!! REMOVING FILE [%s] age --- %d \n", &buff[0], int (time(0) -st.st_mtime));
-               m_output_fs->Unlink(np.c_str());
+               Info info;
+               if (info.Read(fh.get()))
+                  complete = info.IsComplete();
+               fh->Close();
             }
-
+            m_catalog.Update(np, bytes, complete);
          }
       }
    }
 }
 
+void Factory::RebuildCatalog()
+{
+   XrdOucEnv env;
+   for (int i = 0; i < m_cache_dirs.GetNumDirs(); i++)
+   {
+      if (!m_cache_dirs.InService(i))
+         continue;
+      std::string dir = m_cache_dirs.GetPath(i);
+      m_log.Emsg("Catalog", "Scanning cache directory ", dir.c_str());
+      std::auto_ptr<XrdOssDF> dh(m_output_fs->newDir(m_username.c_str()));
+      if (dh->Opendir(dir.c_str(), env) < 0)
+         continue;
+      CheckDirStatRecurse(dh.get(), dir);
+      dh->Close();
+   }
+
+   m_catalog_needs_scan = false;
+
+   std::stringstream ss;
+   ss << m_catalog.GetNumFiles() << " files, " << (m_catalog.GetTotalBytes()/(1024*1024)) << " MB in cache";
+   m_log.Emsg("Catalog", ss.str().c_str());
+}
 
+/*
+ * The checkpoint covers every directory and lives in the first one in
+ * service; if that one fails, the next takes over.
+ */
+bool Factory::GetCatalogPath(std::string &path) const
+{
+   for (int i = 0; i < m_cache_dirs.GetNumDirs(); i++)
+   {
+      if (m_cache_dirs.InService(i))
+      {
+         path = m_cache_dirs.GetPath(i) + "/.filecache-catalog";
+         return true;
+      }
+   }
+   return false;
+}
+
+/*
+ * Cache paths which must not be evicted: files with a live Prefetch and
+ * complete files a client holds open.
+ */
+void Factory::GetActivePaths(std::set<std::string>& paths)
+{
+   std::vector<std::string> urls;
+   {
+      XrdSysMutexHelper monitor(&m_prefetch_mutex);
+      for (PrefetchWeakPtrMap::const_iterator it = m_prefetch_map.begin(); it != m_prefetch_map.end(); ++it)
+         if (it->second.lock())
+            urls.push_back(it->first);
+   }
+   for (std::vector<std::string>::const_iterator it = urls.begin(); it != urls.end(); ++it)
+   {
+      std::string path;
+      if (Cache::getCachePathFromURL(it->c_str(), path))
+         paths.insert(path);
+   }
+}
+
+/*
+ * Remove the least recently accessed files of one cache directory until at
+ * least bytes_to_free bytes have been released.  Files in use are skipped.
+ * If the catalog runs out first it is probably missing files written after
+ * the last checkpoint, so the directories are rescanned for the next round.
+ */
+void Factory::Purge(int dir, long long bytes_to_free)
+{
+   std::vector<Catalog::Record> files;
+   m_catalog.GetByAccess(files);
+
+   std::set<std::string> active;
+   GetActivePaths(active);
+
+   long long freed = 0;
+   int evicted = 0;
+   for (std::vector<Catalog::Record>::const_iterator it = files.begin(); it != files.end() && freed < bytes_to_free; ++it)
+   {
+      if (m_cache_dirs.Find(it->m_path) != dir || active.count(it->m_path) || m_file_table.IsOpen(it->m_path))
+         continue;
+      // A file which cannot be removed stays in the catalog, to be tried
+      // again by a later round.
+      if (m_output_fs->Unlink(it->m_path.c_str()) < 0)
+         continue;
+      m_output_fs->Unlink((it->m_path + Info::m_suffix).c_str());
+      m_file_table.Remove(it->m_path);
+      m_ram_cache.Remove(it->m_path);
+      m_catalog.Remove(it->m_path);
+      freed += it->m_bytes;
+      evicted++;
+   }
+   m_statistics.Add(Statistics::kEvictions, evicted);
+   m_statistics.Add(Statistics::kBytesEvicted, freed);
+
+   std::stringstream ss;
+   ss << "Evicted " << evicted << " files, " << (freed/(1024*1024)) << " MB from";
+   m_log.Emsg("Purge", ss.str().c_str(), m_cache_dirs.GetPath(dir).c_str());
+
+   // Falling short usually means files in use or other data on the file
+   // system; the next interval tries again.  Only a catalog known to be
+   // incomplete is worth a walk of the cache directories.
+   if (freed < bytes_to_free)
+   {
+      if (m_catalog_needs_scan)
+         RebuildCatalog();
+      else
+         m_log.Emsg("Purge", "Could not free enough space in", m_cache_dirs.GetPath(dir).c_str());
+   }
+}
+
+/*
+ * Check the usage of each cache directory every m_purge_interval seconds;
+ * once one rises above the high watermark, evict its files until it is
+ * back under the low watermark.  A directory whose file system can no
+ * longer be looked at is taken out of service.  The catalog is
+ * checkpointed on the same schedule.
+ */
 void Factory::TempDirCleanup()
 {
-   XrdOucEnv env;
+   if (m_catalog_needs_scan)
+      RebuildCatalog();
+
    while (1)
    {   
-      // AMT: I don't know why recreate of XrdOssDF is necessary.
-      //      I think Opendir()/Close() should be enough. 
-      std::auto_ptr<XrdOssDF> dh(m_output_fs->newDir(m_username.c_str()));
-      dh->Opendir(m_temp_directory.c_str(), env);
-      CheckDirStatRecurse(dh.get(), m_temp_directory);
-      dh->Close();
-      sleep(max_temp_dir_age);   
+      for (int i = 0; i < m_cache_dirs.GetNumDirs(); i++)
+      {
+         if (!m_cache_dirs.InService(i))
+            continue;
+         long long total, used;
+         if (!m_cache_dirs.GetUsage(i, total, used))
+         {
+            m_cache_dirs.Fail(i, "statvfs failed");
+            continue;
+         }
+         long long high = static_cast<long long>(m_disk_usage_high * total);
+         long long low = static_cast<long long>(m_disk_usage_low * total);
+         if (used > high)
+            Purge(i, used - low);
+      }
+      std::string catalog_path;
+      if (GetCatalogPath(catalog_path))
+         m_catalog.Checkpoint(*m_output_fs, catalog_path);
+      sleep(m_purge_interval);
    }
 }
 
@@ -143,11 +288,147 @@ void* TempDirCleanupThread(void*)
    return NULL;
 }
 
+/*
+ * Move trace events from the per-thread rings into the log once a second.
+ */
+void Factory::TraceFlush()
+{
+   while (1)
+   {
+      Trace::Flush(m_log);
+      sleep(1);
+   }
+}
+
+void* TraceFlushThread(void*)
+{
+   Factory::GetInstance().TraceFlush();
+   return NULL;
+}
+
+/*
+ * Every m_stats_interval seconds, copy the counters into the statistics
+ * the framework reports and, if configured, rewrite the snapshot file.
+ */
+void Factory::StatsSnapshot()
+{
+   while (1)
+   {
+      sleep(m_stats_interval);
+      m_statistics.Export(m_stats);
+      if (!m_stats_file.empty())
+         WriteStatsFile();
+   }
+}
+
+void* StatsSnapshotThread(void*)
+{
+   Factory::GetInstance().StatsSnapshot();
+   return NULL;
+}
+
+/*
+ * The snapshot is a single JSON object holding the counters, the size of
+ * the cache and the scheduler queue depths.  It is written next to the
+ * target and renamed into place, so readers never see a partial file.
+ */
+bool Factory::WriteStatsFile()
+{
+   Scheduler::QueueDepths depths;
+   m_scheduler.GetQueueDepths(depths);
+
+   std::ostringstream os;
+   os << "{\"time\": " << static_cast<long>(time(0));
+   for (int i = 0; i < Statistics::kNumCounters; i++)
+   {
+      Statistics::Counter c = static_cast<Statistics::Counter>(i);
+      os << ", \"" << Statistics::GetName(c) << "\": " << m_statistics.Get(c);
+   }
+   os << ", \"cache_files\": " << m_catalog.GetNumFiles()
+      << ", \"cache_bytes\": " << m_catalog.GetTotalBytes()
+      << ", \"queue_readahead\": " << depths.m_readahead
+      << ", \"queue_background\": " << depths.m_background
+      << ", \"waiting_demand\": " << depths.m_waiting[Scheduler::kDemand]
+      << ", \"waiting_readahead\": " << depths.m_waiting[Scheduler::kReadahead]
+      << ", \"waiting_background\": " << depths.m_waiting[Scheduler::kBackground];
+
+   BufferPool &pool = BufferPool::GetInstance();
+   os << ", \"buffer_bytes\": " << pool.GetAllocated()
+      << ", \"buffer_high_water\": " << pool.GetHighWater()
+      << ", \"buffer_in_use\": " << pool.GetInUse()
+      << ", \"buffer_in_use_high_water\": " << pool.GetInUseHighWater();
+
+   os << ", \"cache_dirs\": [";
+   for (int i = 0; i < m_cache_dirs.GetNumDirs(); i++)
+   {
+      long long total = 0, used = 0;
+      bool in_service = m_cache_dirs.InService(i) && m_cache_dirs.GetUsage(i, total, used);
+      os << (i ? ", " : "") << "{\"path\": \"" << m_cache_dirs.GetPath(i) << "\""
+         << ", \"weight\": " << m_cache_dirs.GetWeight(i)
+         << ", \"in_service\": " << (in_service ? "true" : "false")
+         << ", \"total_bytes\": " << total
+         << ", \"used_bytes\": " << used
+         << ", \"in_flight\": " << m_cache_dirs.GetInFlight(i) << "}";
+   }
+   os << "]";
+
+   // Latency percentiles cover the reads since the previous snapshot.
+   os << ", \"latency_us\": {";
+   for (int i = 0; i < Statistics::kNumLatencies; i++)
+   {
+      Statistics::Latency l = static_cast<Statistics::Latency>(i);
+      Histogram::Snapshot interval;
+      m_statistics.GetLatencyInterval(l, interval);
+      os << (i ? ", " : "") << "\"" << Statistics::GetName(l) << "\": {\"count\": " << interval.GetCount()
+         << ", \"p50\": " << interval.GetPercentile(0.50)
+         << ", \"p90\": " << interval.GetPercentile(0.90)
+         << ", \"p99\": " << interval.GetPercentile(0.99)
+         << ", \"p999\": " << interval.GetPercentile(0.999) << "}";
+   }
+   os << "}}\n";
+   std::string contents = os.str();
+
+   std::string tmp_path = m_stats_file + ".tmp";
+   FILE *fp = fopen(tmp_path.c_str(), "w");
+   bool ok = fp && fwrite(contents.data(), 1, contents.size(), fp) == contents.size();
+   if (fp && fclose(fp))
+      ok = false;
+   if (!ok || rename(tmp_path.c_str(), m_stats_file.c_str()) < 0)
+   {
+      m_log.Emsg("Stats", errno, "write statistics snapshot", m_stats_file.c_str());
+      return false;
+   }
+   return true;
+}
+
 
 Factory::Factory()
     : m_log(0, "XrdFileCache_"),
       m_temp_directory("/tmp/xrootd-file-cache"),
-      m_username("nobody")
+      m_username("nobody"),
+      m_block_size(1024*1024),
+      m_in_flight(4),
+      m_readahead_max(64*1024*1024),
+      m_sparse_size(0),
+      m_sparse_readahead(8*1024*1024),
+      m_write_batch(4*1024*1024),
+      m_preallocate(true),
+      m_direct_fill(false),
+      m_direct_read(false),
+      m_verify(true),
+      m_prefetch_threads(16),
+      m_scheduler(m_log),
+      m_file_table(m_log),
+      m_catalog(m_log),
+      m_ram_cache(m_log),
+      m_cache_dirs(m_log),
+      m_ram_size(0),
+      m_catalog_needs_scan(false),
+      m_disk_usage_low(0.90),
+      m_disk_usage_high(0.95),
+      m_purge_interval(10),
+      m_stats_interval(60),
+      m_decision_ttl(60)
 {
 }
 
@@ -171,16 +452,24 @@ XrdOucCache *XrdOucGetCache(XrdSysLogger *logger,
 
     pthread_t tid;
     XrdSysThread::Run(&tid, TempDirCleanupThread, NULL, 0, "XrdFileCache TempDirCleanup");
+    XrdSysThread::Run(&tid, StatsSnapshotThread, NULL, 0, "XrdFileCache StatsSnapshot");
+    if (Trace::m_level > Trace::kNone)
+        XrdSysThread::Run(&tid, TraceFlushThread, NULL, 0, "XrdFileCache TraceFlush");
     return &factory;
 }
 }
 
+// Called on every open and read; the lock is only taken until the
+// factory exists.
 Factory &
 Factory::GetInstance()
 {
+    Factory *factory = __atomic_load_n(&m_factory, __ATOMIC_ACQUIRE);
+    if (factory)
+        return *factory;
     XrdSysMutexHelper monitor(&m_factory_mutex);
     if (m_factory == NULL)
-        m_factory = new Factory();
+        __atomic_store_n(&m_factory, new Factory(), __ATOMIC_RELEASE);
     return *m_factory;
 }
 
@@ -232,7 +521,7 @@ Factory::Config(XrdSysLogger *logger, const char *config_filename, const char *p
             retval = false;
             break;
         }
-        if ((strncmp(var, "filecache.", 4) == 0) && (!ConfigXeq(var+4, Config)))
+        if ((strncmp(var, "filecache.", 10) == 0) && (!ConfigXeq(var+10, Config)))
         {
             Config.Echo();
             retval = false;
@@ -254,7 +543,8 @@ Factory::Config(XrdSysLogger *logger, const char *config_filename, const char *p
         retval = ConfigParameters(parameters);
 
     m_log.Emsg("Config", "Cache user name: ", m_username.c_str());
-    m_log.Emsg("Config", "Cache temporary directory: ", m_temp_directory.c_str());
+    std::stringstream ss; ss << m_block_size;
+    m_log.Emsg("Config", "Cache block size: ", ss.str().c_str());
 
     if (retval)
     {
@@ -267,6 +557,53 @@ Factory::Config(XrdSysLogger *logger, const char *config_filename, const char *p
         m_output_fs = output_fs;
     }
 
+    if (retval)
+    {
+        if (m_cache_dirs.IsEmpty())
+            m_cache_dirs.Add(m_temp_directory, 0);
+        if (!m_cache_dirs.Init())
+        {
+            m_log.Emsg("Config", "No usable cache directory.");
+            retval = false;
+        }
+        for (int i = 0; i < m_cache_dirs.GetNumDirs(); i++)
+        {
+            std::stringstream ss;
+            ss << " weight " << m_cache_dirs.GetWeight(i) << (m_cache_dirs.InService(i) ? "" : ", out of service");
+            m_log.Emsg("Config", "Cache directory: ", m_cache_dirs.GetPath(i).c_str(), ss.str().c_str());
+        }
+    }
+
+    // A missing checkpoint means a full scan, which the cleanup thread
+    // does in the background.  Any directory's checkpoint will do.
+    bool loaded = false;
+    for (int i = 0; retval && !loaded && i < m_cache_dirs.GetNumDirs(); i++)
+        loaded = m_cache_dirs.InService(i) &&
+                 m_catalog.Load(*m_output_fs, m_cache_dirs.GetPath(i) + "/.filecache-catalog");
+    if (retval && !loaded)
+    {
+        m_log.Emsg("Config", "No cache catalog checkpoint; cache directory will be rescanned.");
+        m_catalog_needs_scan = true;
+    }
+
+    if (retval && m_direct_fill && (m_block_size % DirectIO::kAlignment))
+    {
+        m_log.Emsg("Config", "directio fill needs a blocksize which is a multiple of 4k");
+        retval = false;
+    }
+
+    if (retval && !m_ram_cache.Init(m_ram_size, m_block_size))
+    {
+        m_log.Emsg("Config", "Unable to set up the RAM cache.");
+        retval = false;
+    }
+
+    if (retval && !m_scheduler.Start(m_prefetch_threads))
+    {
+        m_log.Emsg("Config", "Unable to start prefetch workers.");
+        retval = false;
+    }
+
     if (retval) m_log.Emsg("Config", "Configuration of factory successful");
     else m_log.Emsg("Config", "Configuration of factory failed");
 
@@ -277,6 +614,25 @@ bool Factory::ConfigXeq(char *var, XrdOucStream &Config)
 {
     TS_Xeq("osslib",        xolib);
     TS_Xeq("decisionlib" ,  xdlib);
+    TS_Xeq("blocksize",     xblocksize);
+    TS_Xeq("inflight",      xinflight);
+    TS_Xeq("readahead",     xreadahead);
+    TS_Xeq("prefetchthreads", xprefetchthreads);
+    TS_Xeq("bandwidth",     xbandwidth);
+    TS_Xeq("maxopen",       xmaxopen);
+    TS_Xeq("diskusage",     xdiskusage);
+    TS_Xeq("purgeinterval", xpurgeinterval);
+    TS_Xeq("trace",         xtrace);
+    TS_Xeq("statsfile",     xstatsfile);
+    TS_Xeq("ramsize",       xramsize);
+    TS_Xeq("buffermem",     xbuffermem);
+    TS_Xeq("directio",      xdirectio);
+    TS_Xeq("writebatch",    xwritebatch);
+    TS_Xeq("preallocate",   xpreallocate);
+    TS_Xeq("verify",        xverify);
+    TS_Xeq("cachedir",      xcachedir);
+    TS_Xeq("decisionttl",   xdecisionttl);
+    TS_Xeq("sparse",        xsparse);
     return true;
 }
 
@@ -319,21 +675,30 @@ Factory::xolib(XrdOucStream &Config)
    Purpose:  To parse the directive: decisionlib <path> [<parms>]
 
              <path>  the path of the decision library to be used.
-             <parms> optional parameters to be passed.
+             <parms> optional parameters, passed to the decision's
+                     ConfigDecision if it implements Decision2.
 
    Output: true upon success or false upon failure.
 */
 bool
 Factory::xdlib(XrdOucStream &Config)
 {
-    const char *val; //, parms[2048];
-    //int len;
+    const char *val;
+    char parms[2048];
 
     if (!(val = Config.GetWord()) || !val[0])
     {
         m_log.Emsg("Config", "decisionlib not specified; always caching files");
         val = "XrdFileCacheAllowAlways";
     }
+    std::string libname = val;
+    parms[0] = '\0';
+    if (!Config.GetRest(parms, sizeof(parms)))
+    {
+        m_log.Emsg("Config", "decisionlib parameters too long");
+        return false;
+    }
+    val = libname.c_str();
 
 #if defined(HAVE_VERSIONS)
     XrdSysPlugin myLib(&m_log, val, "decisionlib", NULL);
@@ -350,10 +715,627 @@ Factory::xdlib(XrdOucStream &Config)
        m_log.Emsg("Config", "decisionlib was not able to create a decision object");
        return false;
     }
+    Decision2 *d2 = dynamic_cast<Decision2 *>(d);
+    if (d2 && !d2->ConfigDecision(parms))
+    {
+       m_log.Emsg("Config", "decisionlib rejected its parameters:", parms);
+       delete d;
+       return false;
+    }
+    if (!d2 && parms[0])
+       m_log.Emsg("Config", "decisionlib takes no parameters; ignoring", parms);
     m_decisionpoints.push_back(d);
     return true;
 }
 
+/* Function: xblocksize
+
+   Purpose:  To parse the directive: blocksize <size>
+
+             <size>  the size of a cache block; suffixes k, m and g are
+                     accepted.  Files already in the cache keep the block
+                     size recorded in their info file.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xblocksize(XrdOucStream &Config)
+{
+    char *val;
+    long long size;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "blocksize not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2sz(m_log, "blocksize", val, &size, 4*1024, 512*1024*1024))
+        return false;
+
+    m_block_size = size;
+    return true;
+}
+
+/* Function: xinflight
+
+   Purpose:  To parse the directive: inflight <num>
+
+             <num>   the number of block requests kept outstanding against
+                     the origin for each file being prefetched.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xinflight(XrdOucStream &Config)
+{
+    char *val;
+    int num;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "inflight value not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2i(m_log, "inflight", val, &num, 1, 64))
+        return false;
+
+    m_in_flight = num;
+    return true;
+}
+
+/* Function: xreadahead
+
+   Purpose:  To parse the directive: readahead <size>
+
+             <size>  the largest readahead window kept ahead of a client
+                     reading sequentially; suffixes k, m and g are
+                     accepted.  A client that reaches it has the rest of
+                     the file prefetched.  0 disables readahead.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xreadahead(XrdOucStream &Config)
+{
+    char *val;
+    long long size;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "readahead size not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2sz(m_log, "readahead", val, &size, 0, 16LL*1024*1024*1024))
+        return false;
+
+    m_readahead_max = size;
+    return true;
+}
+
+/* Function: xprefetchthreads
+
+   Purpose:  To parse the directive: prefetchthreads <num>
+
+             <num>   the number of worker threads shared by all files
+                     being prefetched.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xprefetchthreads(XrdOucStream &Config)
+{
+    char *val;
+    int num;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "prefetchthreads value not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2i(m_log, "prefetchthreads", val, &num, 1, 1024))
+        return false;
+
+    m_prefetch_threads = num;
+    return true;
+}
+
+/* Function: xbandwidth
+
+   Purpose:  To parse the directive: bandwidth <rate>
+
+             <rate>  the number of bytes per second the cache may read from
+                     the origin, shared by client misses and prefetching;
+                     suffixes k, m and g are accepted.  0 means unlimited.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xbandwidth(XrdOucStream &Config)
+{
+    char *val;
+    long long rate;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "bandwidth value not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2sz(m_log, "bandwidth", val, &rate, 0))
+        return false;
+
+    m_scheduler.SetBandwidth(rate);
+    return true;
+}
+
+/* Function: xmaxopen
+
+   Purpose:  To parse the directive: maxopen <num>
+
+             <num>   the number of complete cache files whose handles are
+                     kept open for sharing between clients.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xmaxopen(XrdOucStream &Config)
+{
+    char *val;
+    int num;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "maxopen value not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2i(m_log, "maxopen", val, &num, 1))
+        return false;
+
+    m_file_table.SetMaxOpen(num);
+    return true;
+}
+
+/* Function: xdiskusage
+
+   Purpose:  To parse the directive: diskusage <low> <high>
+
+             <low>   fraction of the cache disk to bring usage back down to
+                     when purging.
+             <high>  fraction of the cache disk at which purging starts.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xdiskusage(XrdOucStream &Config)
+{
+    char *val, *end;
+    double low, high;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "diskusage low watermark not specified");
+        return false;
+    }
+    low = strtod(val, &end);
+    if (*end || low <= 0 || low >= 1)
+    {
+        m_log.Emsg("Config", "diskusage low watermark must be a fraction between 0 and 1:", val);
+        return false;
+    }
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "diskusage high watermark not specified");
+        return false;
+    }
+    high = strtod(val, &end);
+    if (*end || high <= low || high > 1)
+    {
+        m_log.Emsg("Config", "diskusage high watermark must be above the low one and at most 1:", val);
+        return false;
+    }
+
+    m_disk_usage_low = low;
+    m_disk_usage_high = high;
+    return true;
+}
+
+/* Function: xpurgeinterval
+
+   Purpose:  To parse the directive: purgeinterval <time>
+
+             <time>  how often disk usage is checked against the high
+                     watermark.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xpurgeinterval(XrdOucStream &Config)
+{
+    char *val;
+    int interval;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "purgeinterval value not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2tm(m_log, "purgeinterval", val, &interval, 1))
+        return false;
+
+    m_purge_interval = interval;
+    return true;
+}
+
+/* Function: xtrace
+
+   Purpose:  To parse the directive: trace <level>
+
+             <level> one of none, info, debug or dump.  info logs files
+                     being opened, resumed and closed; debug adds every
+                     prefetched block; dump adds every client read.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xtrace(XrdOucStream &Config)
+{
+    char *val;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "trace level not specified");
+        return false;
+    }
+    if (!Trace::ParseLevel(val, Trace::m_level))
+    {
+        m_log.Emsg("Config", "invalid trace level", val);
+        return false;
+    }
+    return true;
+}
+
+/* Function: xstatsfile
+
+   Purpose:  To parse the directive: statsfile <path> [<interval>]
+
+             <path>     file rewritten with a JSON snapshot of the cache
+                        statistics.
+             <interval> seconds between snapshots; suffixes s, m and h
+                        are accepted.  The default is 60s.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xstatsfile(XrdOucStream &Config)
+{
+    char *val;
+    int interval;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "statsfile path not specified");
+        return false;
+    }
+    m_stats_file = val;
+
+    if ((val = Config.GetWord()) && val[0])
+    {
+        if (XrdOuca2x::a2tm(m_log, "statsfile interval", val, &interval, 1))
+            return false;
+        m_stats_interval = interval;
+    }
+    return true;
+}
+
+/* Function: xramsize
+
+   Purpose:  To parse the directive: ramsize <size>
+
+             <size>  memory set aside for keeping frequently read blocks in
+                     RAM; suffixes k, m and g are accepted.  0, the default,
+                     disables the RAM cache.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xramsize(XrdOucStream &Config)
+{
+    char *val;
+    long long size;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "ramsize not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2sz(m_log, "ramsize", val, &size, 0))
+        return false;
+
+    m_ram_size = size;
+    return true;
+}
+
+/* Function: xbuffermem
+
+   Purpose:  To parse the directive: buffermem <size>
+
+             <size>  memory kept in the pool of I/O buffers used for
+                     prefetching, misses and readv staging; suffixes k, m
+                     and g are accepted.  Buffers are still handed out past
+                     this, but are freed instead of pooled when returned.
+                     The default is 256m.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xbuffermem(XrdOucStream &Config)
+{
+    char *val;
+    long long size;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "buffermem not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2sz(m_log, "buffermem", val, &size, 0))
+        return false;
+
+    BufferPool::GetInstance().SetCap(size);
+    return true;
+}
+
+/* Function: xdirectio
+
+   Purpose:  To parse the directive: directio {none | fill | read | all}
+
+             none    cache files are read and written through the page
+                     cache; the default.
+             fill    blocks are written to cache files with O_DIRECT; the
+                     tail block of a file is still written buffered.
+             read    cache hits are read with O_DIRECT.
+             all     both.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xdirectio(XrdOucStream &Config)
+{
+    char *val;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "directio mode not specified");
+        return false;
+    }
+    if      (!strcmp(val, "none")) {m_direct_fill = false; m_direct_read = false;}
+    else if (!strcmp(val, "fill")) {m_direct_fill = true;  m_direct_read = false;}
+    else if (!strcmp(val, "read")) {m_direct_fill = false; m_direct_read = true;}
+    else if (!strcmp(val, "all"))  {m_direct_fill = true;  m_direct_read = true;}
+    else
+    {
+        m_log.Emsg("Config", "invalid directio mode", val);
+        return false;
+    }
+    if ((m_direct_fill || m_direct_read) && !DirectIO::OpenFlag())
+        m_log.Emsg("Config", "O_DIRECT is not supported on this platform; directio ignored");
+    return true;
+}
+
+/* Function: xwritebatch
+
+   Purpose:  To parse the directive: writebatch <size>
+
+             <size>  the most a prefetch worker fetches from the origin
+                     and writes to the cache file in one go, as a run of
+                     consecutive missing blocks; suffixes k, m and g are
+                     accepted.  Anything up to one block fetches a single
+                     block at a time.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xwritebatch(XrdOucStream &Config)
+{
+    char *val;
+    long long size;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "writebatch size not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2sz(m_log, "writebatch", val, &size, 0, 1024LL*1024*1024))
+        return false;
+
+    m_write_batch = size;
+    return true;
+}
+
+/* Function: xpreallocate
+
+   Purpose:  To parse the directive: preallocate {on | off}
+
+             on      reserve the full size of a new cache file on disk
+                     when it is created, so it is laid out contiguously
+                     and a full disk shows up at open rather than
+                     halfway through a prefetch; the default.
+             off     let the file grow as blocks arrive.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xpreallocate(XrdOucStream &Config)
+{
+    char *val;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "preallocate setting not specified");
+        return false;
+    }
+    if      (!strcmp(val, "on"))  m_preallocate = true;
+    else if (!strcmp(val, "off")) m_preallocate = false;
+    else
+    {
+        m_log.Emsg("Config", "invalid preallocate setting", val);
+        return false;
+    }
+    return true;
+}
+
+/* Function: xverify
+
+   Purpose:  To parse the directive: verify {on | off}
+
+             on      check each block of a cache file against its CRC32C
+                     the first time it is read after the file is opened,
+                     and fetch blocks which fail again from the origin;
+                     the default.
+             off     trust the cache disk.  Checksums are still stored.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xverify(XrdOucStream &Config)
+{
+    char *val;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "verify setting not specified");
+        return false;
+    }
+    if      (!strcmp(val, "on"))  m_verify = true;
+    else if (!strcmp(val, "off")) m_verify = false;
+    else
+    {
+        m_log.Emsg("Config", "invalid verify setting", val);
+        return false;
+    }
+    return true;
+}
+
+/* Function: xcachedir
+
+   Purpose:  To parse the directive: cachedir <path> [<weight>]
+
+             <path>   a directory to keep cached files in, usually the
+                      mount point of one disk.  Repeat the directive for
+                      each disk; files are spread over all of them.  With
+                      no cachedir, the -temp parameter or its default is
+                      used.
+             <weight> the share of files the directory gets relative to
+                      the others.  Defaults to the size of its file
+                      system in GB.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xcachedir(XrdOucStream &Config)
+{
+    char *val;
+    std::string path;
+    double weight = 0;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "cachedir path not specified");
+        return false;
+    }
+    if (val[0] != '/')
+    {
+        m_log.Emsg("Config", "cachedir path must be absolute", val);
+        return false;
+    }
+    path = val;
+
+    if ((val = Config.GetWord()) && val[0])
+    {
+        char *end;
+        weight = strtod(val, &end);
+        if (*end || weight <= 0)
+        {
+            m_log.Emsg("Config", "invalid cachedir weight", val);
+            return false;
+        }
+    }
+
+    m_cache_dirs.Add(path, weight);
+    return true;
+}
+
+/* Function: xdecisionttl
+
+   Purpose:  To parse the directive: decisionttl <time>
+
+             <time>   how long the verdict of the decision plugins on a
+                      path, or on a directory where a plugin says its
+                      verdict holds for all of it, is reused before they
+                      are asked again.  Plugins may ask for less.
+                      Defaults to 60s; 0 asks them on every open.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xdecisionttl(XrdOucStream &Config)
+{
+    char *val;
+    int ttl;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "decisionttl value not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2tm(m_log, "decisionttl", val, &ttl, 0))
+        return false;
+
+    m_decision_ttl = ttl;
+    return true;
+}
+
+/* Function: xsparse
+
+   Purpose:  To parse the directive: sparse <size> [<readahead>]
+
+             <size>      files of at least this size are cached sparsely:
+                         only the blocks clients read are kept, plus at
+                         most <readahead> ahead of each client, and the
+                         rest of the file is never prefetched.  The cache
+                         file is not preallocated and only takes up the
+                         space of the blocks in it.  Decision plugins may
+                         make smaller files sparse too.  0, the default,
+                         leaves it to the plugins.
+             <readahead> the largest readahead window for a sparse file;
+                         defaults to 8m.
+
+   Output: true upon success or false upon failure.
+*/
+bool
+Factory::xsparse(XrdOucStream &Config)
+{
+    char *val;
+    long long size;
+
+    if (!(val = Config.GetWord()) || !val[0])
+    {
+        m_log.Emsg("Config", "sparse size not specified");
+        return false;
+    }
+    if (XrdOuca2x::a2sz(m_log, "sparse size", val, &size, 0))
+        return false;
+    m_sparse_size = size;
+
+    if ((val = Config.GetWord()) && val[0])
+    {
+        if (XrdOuca2x::a2sz(m_log, "sparse readahead", val, &size, 0, 16LL*1024*1024*1024))
+            return false;
+        m_sparse_readahead = size;
+    }
+    return true;
+}
+
 bool
 Factory::ConfigParameters(const char * parameters)
 {
@@ -386,55 +1368,143 @@ Factory::ConfigParameters(const char * parameters)
                 m_log.Emsg("Config", "No temporary directory specified.");
                 return false;
             }
+            m_temp_directory = val;
         }
     }
 
     return true;
 }
 
+// Opens differing only in their CGI are of the same file, and share its
+// cache file; the plugins and the Prefetch map see the path without it.
+static std::string
+PrefetchKey(XrdOucCacheIO &io)
+{
+    std::string filename = io.Path();
+    std::string::size_type query = filename.find('?');
+    if (query != std::string::npos)
+        filename.erase(query);
+    return filename;
+}
+
+/*
+ * The Prefetch already filling the file io reads, if there is one still
+ * taking readers; unlike GetPrefetch, never consults the plugins or
+ * creates one.
+ */
+PrefetchPtr
+Factory::FindPrefetch(XrdOucCacheIO & io)
+{
+    std::string filename = PrefetchKey(io);
+    XrdSysMutexHelper monitor(&m_prefetch_mutex);
+    PrefetchWeakPtrMap::const_iterator it = m_prefetch_map.find(filename);
+    PrefetchPtr result;
+    if (it != m_prefetch_map.end())
+        result = it->second.lock();
+    if (result && result->HasEnded())
+        result.reset();
+    return result;
+}
+
 PrefetchPtr
 Factory::GetPrefetch(XrdOucCacheIO & io)
 {
-    std::string filename = io.Path();
-    m_log.Emsg("GetPrefetch", "Prefetch object requested for ", filename.c_str());
-    if (!Decide(filename))
+    if (TRACE_ON(kInfo))
+        m_log.Emsg("GetPrefetch", "Prefetch object requested for ", io.Path());
+    std::string filename = PrefetchKey(io);
+    // Plugins may rewrite the path they are given.
+    std::string decision_path = filename;
+    bool sparse;
+    if (!Decide(decision_path, io.FSize(), sparse))
     {
         PrefetchPtr result;
         return result;
     }
-    XrdSysMutexHelper monitor(&m_factory_mutex);
+    XrdSysMutexHelper monitor(&m_prefetch_mutex);
     PrefetchWeakPtrMap::const_iterator it = m_prefetch_map.find(filename);
 
     if (it == m_prefetch_map.end())
     {
         PrefetchPtr result;
-        result.reset(new Prefetch(m_log, *m_output_fs, io));
+        result.reset(new Prefetch(m_log, *m_output_fs, io, sparse));
         m_prefetch_map[filename] = result;
         return result;
     }
+    // One which ended early is as good as gone: AddReader cannot revive it.
     PrefetchPtr result = it->second.lock();
-    if (!result)
+    if (!result || result->HasEnded())
     {
-        result.reset(new Prefetch(m_log, *m_output_fs, io));
+        result.reset(new Prefetch(m_log, *m_output_fs, io, sparse));
         m_prefetch_map[filename] = result;
         return result;
     }
     return result;
 }
 
+/*
+ * Runs without any lock of the factory's; plugins see concurrent calls.
+ * The verdict is remembered for the shortest time any plugin consulted
+ * allows, and for a whole directory if each of them says it holds there.
+ * Concurrent first opens of a path may all run the plugins.
+ *
+ * sparse is set if the file is to be cached sparsely: it reaches the
+ * filecache.sparse size, or a plugin asks for it.
+ */
 bool
-Factory::Decide(std::string &filename)
+Factory::Decide(std::string &filename, long long size, bool &sparse)
 {
+    bool by_size = m_sparse_size > 0 && size >= m_sparse_size;
+    sparse = by_size;
+    if (m_decisionpoints.empty())
+        return true;
+
+    bool verdict;
+    if (m_decision_ttl > 0 && m_decision_cache.Get(filename, verdict, sparse))
+    {
+        m_statistics.Add(Statistics::kDecisionsCached, 1);
+        sparse = sparse || by_size;
+        return verdict;
+    }
+    m_statistics.Add(Statistics::kDecisionsRun, 1);
+
+    // Plugins may rewrite the path they are given.
+    std::string key = filename;
+    std::string scope;
+    bool scoped = true;
+    int ttl = m_decision_ttl;
+    verdict = true;
+    sparse = false;
     std::vector<Decision*>::const_iterator it;
     for (it = m_decisionpoints.begin(); it != m_decisionpoints.end(); ++it)
     {
         Decision *d = *it;
         if (!d) continue;
-        if (!d->Decide(filename, *m_output_fs))
+        // Plugins with only the original interface get the defaults.
+        Decision2 *d2 = dynamic_cast<Decision2 *>(d);
+        bool accepted = d2 ? d2->DecideFile(filename, size, *m_output_fs) : d->Decide(filename, *m_output_fs);
+
+        int cache_time = d2 ? d2->GetCacheTime() : -1;
+        if (cache_time >= 0 && cache_time < ttl)
+            ttl = cache_time;
+        std::string prefix;
+        if (scoped && d2 && d2->GetVerdictScope(key, prefix) && !key.compare(0, prefix.size(), prefix))
         {
-            return false;
+            if (prefix.size() > scope.size())
+                scope = prefix;
         }
+        else
+            scoped = false;
+
+        if (!accepted)
+        {
+            verdict = false;
+            break;
+        }
+        sparse = sparse || (d2 && d2->DecideSparse(key, size));
     }
-    return true;
+    if (ttl > 0)
+        m_decision_cache.Put((scoped && !scope.empty()) ? scope : key, verdict, sparse, ttl);
+    sparse = sparse || by_size;
+    return verdict;
 }
 
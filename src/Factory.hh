@@ -10,8 +10,16 @@
 
 #include <string>
 #include <vector>
+#include <set>
 
 #include "XrdFileCacheFwd.hh"
+#include "Scheduler.hh"
+#include "FileTable.hh"
+#include "Catalog.hh"
+#include "Statistics.hh"
+#include "RamCache.hh"
+#include "CacheDirs.hh"
+#include "DecisionCache.hh"
 
 #include <XrdSys/XrdSysPthread.hh>
 #include <XrdOuc/XrdOucCache.hh>
@@ -40,15 +48,32 @@ public:
     virtual XrdOucCache *Create(Parms &, XrdOucCacheIO::aprParms *aprP=0);
 
     std::string &GetUsername() {return m_username;}
-    std::string &GetTempDirectory() {return m_temp_directory;}
+    long long GetBlockSize() const {return m_block_size;}
+    int GetInFlight() const {return m_in_flight;}
+    long long GetReadaheadMax() const {return m_readahead_max;}
+    long long GetSparseReadahead() const {return m_sparse_readahead;}
+    long long GetWriteBatch() const {return m_write_batch;}
+    bool GetPreallocate() const {return m_preallocate;}
+    bool GetDirectFill() const {return m_direct_fill;}
+    bool GetDirectRead() const {return m_direct_read;}
+    bool GetVerify() const {return m_verify;}
+    Scheduler &GetScheduler() {return m_scheduler;}
+    FileTable &GetFileTable() {return m_file_table;}
+    Catalog &GetCatalog() {return m_catalog;}
+    Statistics &GetStatistics() {return m_statistics;}
+    RamCache &GetRamCache() {return m_ram_cache;}
+    CacheDirs &GetCacheDirs() {return m_cache_dirs;}
     XrdOss* &GetOss() {return m_output_fs;}
 
     void TempDirCleanup();
+    void TraceFlush();
+    void StatsSnapshot();
     static Factory &GetInstance();
 
 protected:
 
     PrefetchPtr GetPrefetch(XrdOucCacheIO &);
+    PrefetchPtr FindPrefetch(XrdOucCacheIO &);
     void Detach(PrefetchPtr);
 
 private:
@@ -59,10 +84,34 @@ private:
     bool ConfigXeq(char *, XrdOucStream &);
     bool xolib(XrdOucStream &);
     bool xdlib(XrdOucStream &);
-
-    bool Decide(std::string &);
+    bool xblocksize(XrdOucStream &);
+    bool xinflight(XrdOucStream &);
+    bool xreadahead(XrdOucStream &);
+    bool xprefetchthreads(XrdOucStream &);
+    bool xbandwidth(XrdOucStream &);
+    bool xmaxopen(XrdOucStream &);
+    bool xdiskusage(XrdOucStream &);
+    bool xpurgeinterval(XrdOucStream &);
+    bool xtrace(XrdOucStream &);
+    bool xstatsfile(XrdOucStream &);
+    bool xramsize(XrdOucStream &);
+    bool xbuffermem(XrdOucStream &);
+    bool xdirectio(XrdOucStream &);
+    bool xwritebatch(XrdOucStream &);
+    bool xpreallocate(XrdOucStream &);
+    bool xverify(XrdOucStream &);
+    bool xcachedir(XrdOucStream &);
+    bool xdecisionttl(XrdOucStream &);
+    bool xsparse(XrdOucStream &);
+
+    bool Decide(std::string &, long long size, bool &sparse);
 
     void CheckDirStatRecurse( XrdOssDF* df, std::string& path);
+    void RebuildCatalog();
+    bool GetCatalogPath(std::string &path) const;
+    void GetActivePaths(std::set<std::string>& paths);
+    void Purge(int dir, long long bytes_to_free);
+    bool WriteStatsFile();
 
     static XrdSysMutex m_factory_mutex;
     static Factory * m_factory;
@@ -73,9 +122,36 @@ private:
     std::string m_config_filename;
     std::string m_temp_directory;
     std::string m_username;
+    long long m_block_size;
+    int m_in_flight;
+    long long m_readahead_max;
+    long long m_sparse_size;
+    long long m_sparse_readahead;
+    long long m_write_batch;
+    bool m_preallocate;
+    bool m_direct_fill;
+    bool m_direct_read;
+    bool m_verify;
+    int m_prefetch_threads;
+    Scheduler m_scheduler;
+    FileTable m_file_table;
+    Catalog m_catalog;
+    RamCache m_ram_cache;
+    CacheDirs m_cache_dirs;
+    long long m_ram_size;
+    bool m_catalog_needs_scan;
+    double m_disk_usage_low;
+    double m_disk_usage_high;
+    int m_purge_interval;
+    Statistics m_statistics;
+    std::string m_stats_file;
+    int m_stats_interval;
+    XrdSysMutex m_prefetch_mutex; // guards m_prefetch_map
     PrefetchWeakPtrMap m_prefetch_map;
     XrdOss *m_output_fs;
     std::vector<Decision*> m_decisionpoints;
+    DecisionCache m_decision_cache;
+    int m_decision_ttl;
 
 };
 
@@ -0,0 +1,86 @@
+
+#include "XrdOss/XrdOss.hh"
+#include "XrdSys/XrdSysError.hh"
+
+#include "FileTable.hh"
+#include "CachedFile.hh"
+#include "Factory.hh"
+
+using namespace XrdFileCache;
+
+FileTable::FileTable(XrdSysError &log)
+    : m_max_open(1024),
+      m_log(log)
+{
+}
+
+CachedFilePtr
+FileTable::Get(const std::string &path)
+{
+    {
+        XrdSysMutexHelper lock(&m_mutex);
+        EntryMap::iterator it = m_entries.find(path);
+        if (it != m_entries.end())
+        {
+            m_lru.splice(m_lru.begin(), m_lru, it->second.m_lru);
+            return it->second.m_file;
+        }
+    }
+
+    // Open outside the lock; if we race another opener, keep theirs.
+    CachedFilePtr file(new CachedFile(m_log));
+    if (!file->Open(*Factory::GetInstance().GetOss(), path))
+        return CachedFilePtr();
+    if (!file->IsComplete())
+        return file;
+
+    XrdSysMutexHelper lock(&m_mutex);
+    EntryMap::iterator it = m_entries.find(path);
+    if (it != m_entries.end())
+    {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.m_lru);
+        return it->second.m_file;
+    }
+    Entry &entry = m_entries[path];
+    entry.m_file = file;
+    m_lru.push_front(path);
+    entry.m_lru = m_lru.begin();
+    Trim();
+    return file;
+}
+
+void
+FileTable::Remove(const std::string &path)
+{
+    XrdSysMutexHelper lock(&m_mutex);
+    EntryMap::iterator it = m_entries.find(path);
+    if (it == m_entries.end())
+        return;
+    m_lru.erase(it->second.m_lru);
+    m_entries.erase(it);
+}
+
+bool
+FileTable::IsOpen(const std::string &path)
+{
+    XrdSysMutexHelper lock(&m_mutex);
+    EntryMap::iterator it = m_entries.find(path);
+    return (it != m_entries.end()) && !it->second.m_file.unique();
+}
+
+// Must be called with m_mutex held.  Handles still referenced by a client
+// are skipped, so the bound can be exceeded while they are all in use.
+void
+FileTable::Trim()
+{
+    std::list<std::string>::iterator it = m_lru.end();
+    while (static_cast<int>(m_entries.size()) > m_max_open && it != m_lru.begin())
+    {
+        --it;
+        EntryMap::iterator entry = m_entries.find(*it);
+        if (!entry->second.m_file.unique())
+            continue;
+        m_entries.erase(entry);
+        it = m_lru.erase(it);
+    }
+}
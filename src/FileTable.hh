@@ -0,0 +1,68 @@
+#ifndef __XRDFILECACHE_FILETABLE_HH__
+#define __XRDFILECACHE_FILETABLE_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * Open handles on complete cache files, shared by every client reading the
+ * same file.  Handles are reference counted; the table keeps idle handles
+ * open for reuse, closing the least recently used ones once more than the
+ * configured number of files are open.
+ */
+
+#include <list>
+#include <string>
+
+#include <XrdSys/XrdSysPthread.hh>
+
+#include "XrdFileCacheFwd.hh"
+
+class XrdSysError;
+
+namespace XrdFileCache {
+
+class FileTable
+{
+
+public:
+
+    FileTable(XrdSysError &);
+
+    void SetMaxOpen(int max_open) {m_max_open = max_open;}
+
+    // Return a handle on the cached file at path, or an empty pointer if
+    // it is not in the cache.  Handles on partially cached files are not
+    // shared, as their block map may still change.
+    CachedFilePtr Get(const std::string &path);
+
+    // Forget the handle for a file which has been removed from the cache.
+    void Remove(const std::string &path);
+
+    bool IsOpen(const std::string &path);
+
+private:
+
+    struct Entry
+    {
+        CachedFilePtr m_file;
+        std::list<std::string>::iterator m_lru;
+    };
+    typedef std::tr1::unordered_map<std::string, Entry> EntryMap;
+
+    void Trim();
+
+    XrdSysMutex m_mutex;
+    EntryMap m_entries;
+    std::list<std::string> m_lru; // most recently used at the front
+    int m_max_open;
+    XrdSysError & m_log;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,58 @@
+
+#include <time.h>
+
+#include "Histogram.hh"
+
+using namespace XrdFileCache;
+
+Histogram::Histogram()
+{
+    for (int i = 0; i < kNumBuckets; i++)
+        m_buckets[i] = 0;
+}
+
+void
+Histogram::Get(Snapshot &snapshot) const
+{
+    for (int i = 0; i < kNumBuckets; i++)
+        snapshot.m_buckets[i] = __atomic_load_n(&m_buckets[i], __ATOMIC_RELAXED);
+}
+
+long long
+Histogram::Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+long long
+Histogram::Snapshot::GetCount() const
+{
+    long long count = 0;
+    for (int i = 0; i < kNumBuckets; i++)
+        count += m_buckets[i];
+    return count;
+}
+
+long long
+Histogram::Snapshot::GetPercentile(double p) const
+{
+    long long count = GetCount();
+    if (!count)
+        return 0;
+    double target = p * count;
+    long long below = 0;
+    for (int i = 0; i < kNumBuckets; i++)
+    {
+        if (!m_buckets[i] || below + m_buckets[i] < target)
+        {
+            below += m_buckets[i];
+            continue;
+        }
+        long long lower = i ? (1LL << i) : 0;
+        long long upper = 1LL << (i + 1);
+        return lower + static_cast<long long>((upper - lower) * (target - below) / m_buckets[i]);
+    }
+    return 1LL << kNumBuckets;
+}
@@ -0,0 +1,60 @@
+#ifndef __XRDFILECACHE_HISTOGRAM_HH__
+#define __XRDFILECACHE_HISTOGRAM_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * Fixed-size latency histogram with power-of-two buckets: bucket i counts
+ * values in [2^i, 2^(i+1)) microseconds, bucket 0 also taking anything
+ * below 1us and the last bucket anything above its lower bound.  Record
+ * is a single atomic increment, so any number of threads may record
+ * while another takes a snapshot.
+ */
+
+namespace XrdFileCache {
+
+class Histogram
+{
+
+public:
+
+    static const int kNumBuckets = 32;
+
+    struct Snapshot
+    {
+        long long m_buckets[kNumBuckets];
+
+        long long GetCount() const;
+
+        // Latency in microseconds below which fraction p of the values
+        // fall, interpolated within the bucket; 0 if there are none.
+        long long GetPercentile(double p) const;
+    };
+
+    Histogram();
+
+    void Record(long long micros)
+    {
+        int bucket = micros > 1 ? 63 - __builtin_clzll(micros) : 0;
+        if (bucket >= kNumBuckets) bucket = kNumBuckets - 1;
+        __sync_fetch_and_add(&m_buckets[bucket], 1);
+    }
+
+    void Get(Snapshot &) const;
+
+    // Microseconds on a monotonic clock, for timing what gets recorded.
+    static long long Now();
+
+private:
+
+    long long m_buckets[kNumBuckets];
+
+};
+
+}
+
+#endif
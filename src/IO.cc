@@ -1,30 +1,56 @@
 #include "IO.hh"
 #include "Cache.hh"
 #include "Prefetch.hh"
+#include "CachedFile.hh"
+#include "Factory.hh"
+#include "Scheduler.hh"
+#include "Catalog.hh"
+#include "Trace.hh"
+#include "Statistics.hh"
+#include "RamCache.hh"
+#include "BufferPool.hh"
 
-#include <sstream>
 #include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
 
 #include "XrdClient/XrdClientConst.hh"
 #include "XrdSys/XrdSysError.hh"
 #include "XrdSfs/XrdSfsInterface.hh"
 using namespace XrdFileCache;
 
-IO::IO(XrdOucCacheIO &io, XrdOucCacheStats &stats, Cache & cache, PrefetchPtr pread, XrdSysError &log)
+IO::IO(XrdOucCacheIO &io, XrdOucCacheStats &stats, Cache & cache, PrefetchPtr pread, CachedFilePtr cached, XrdSysError &log)
     : m_io(io),
       m_stats(stats),
       m_prefetch(pread),
+      m_cached_file(cached),
       m_cache(cache),
+      m_pattern(Factory::GetInstance().GetBlockSize(),
+                (pread && pread->IsSparse()) ? Factory::GetInstance().GetSparseReadahead() : Factory::GetInstance().GetReadaheadMax(),
+                io.FSize()),
+      m_full_requested(false),
       m_log(log)
-{}
+{
+    if (!Cache::getCachePathFromURL(m_io.Path(), m_cache_path))
+        m_cache_path.clear();
+    Factory::GetInstance().GetStatistics().Add(Statistics::kOpenFiles, 1);
+}
+
+IO::~IO()
+{
+    Factory::GetInstance().GetStatistics().Add(Statistics::kOpenFiles, -1);
+}
 
 XrdOucCacheIO *
 IO::Detach()
 {
     XrdOucCacheIO * io = &m_io;
+    if (!m_cache_path.empty())
+        Factory::GetInstance().GetCatalog().Access(m_cache_path);
     if (m_prefetch.get())
     {
-        m_prefetch->CloseCleanly();
+        m_prefetch->RemoveReader(&m_io);
     }
     m_cache.Detach(this); // This will delete us!
     return io;
@@ -35,44 +61,218 @@ IO::Detach()
  */
 int IO::Read (char *buff, long long off, int size)
 {
-    std::stringstream ss; ss << "Read " << off << "@" << size;
-    m_log.Emsg("IO", ss.str().c_str());
-    ssize_t bytes_read = 0;
-    ssize_t retval = 0;
-
-    if (m_cache.readFromDisk())
-    {
-       m_log.Emsg("IO", ">>> read from disk");
-       retval = m_cache.getCachedFile()->Read(buff, off, size);
-    }
-    else if (m_prefetch)
+    TRACE(kDump, "IO::Read", "offset size", off, size);
+    long long start = Histogram::Now();
+    if (m_prefetch)
     {
-       if (m_prefetch->hasCompletedSuccessfully())
-       {
-          m_log.Emsg("IO", ">>> open file from disk and read from it");
-          m_cache.checkDiskCache(&m_io);
-          retval = m_cache.getCachedFile()->Read(buff, off, size);
-       }
-       else
-       {
-          m_log.Emsg("IO", ">>> read from Prefetch");
-          retval = m_prefetch->Read(buff, off, size);     
-       }
+        XrdSysMutexHelper lock(m_pattern_mutex);
+        m_pattern.Record(off, size);
     }
+    Readahead();
+
+    ssize_t bytes_read = 0;
+    long long ram_bytes;
+    ssize_t retval = ReadFromCache(buff, off, size, ram_bytes);
 
     if (retval > 0)
     {
        bytes_read += retval;
        buff += retval;
+       off += retval;
        size -= retval;
     }
+    ssize_t cached = bytes_read;
 
-
-    if ((size > 0) && ((retval = m_io.Read(buff, off, size)) > 0))
+    if (size > 0)
     {
+        if ((retval = ReadMiss(buff, off, size)) > 0)
             bytes_read += retval;
     }
-    return (retval < 0) ? retval : bytes_read;
+    if (retval < 0)
+        return retval;
+    Factory::GetInstance().GetStatistics().AddRead(CacheSource(), ram_bytes, cached, bytes_read, false, Histogram::Now() - start);
+    return bytes_read;
+}
+
+/*
+ * Pass whatever the access pattern says should be read ahead on to the
+ * Prefetch and make sure a worker picks it up.  Nothing is requested
+ * until the Prefetch has its cache file open, and a sparse file is never
+ * asked for in full.
+ */
+void IO::Readahead ()
+{
+    if (!m_prefetch || !m_prefetch->GetBlockSize())
+        return;
+
+    AccessPattern::Ranges ranges;
+    bool full = false;
+    {
+        XrdSysMutexHelper lock(m_pattern_mutex);
+        m_pattern.GetReadahead(ranges);
+        if (!m_full_requested && !m_prefetch->IsSparse() && m_pattern.WantsFullFile())
+            full = m_full_requested = true;
+    }
+
+    bool added = false;
+    for (AccessPattern::Ranges::const_iterator it = ranges.begin(); it != ranges.end(); ++it)
+        added = m_prefetch->Readahead(it->first, it->second) || added;
+    if (full)
+        m_prefetch->SetFullPrefetch(true);
+    if (added || full)
+        Factory::GetInstance().GetScheduler().Schedule(m_prefetch);
+}
+
+/*
+ * Read the run of cached bytes starting at off, block by block from the
+ * RAM cache where it has them and from disk otherwise.  A block read from
+ * disk which the RAM cache admits is loaded whole.  ram_bytes is set to
+ * the bytes which came from RAM.
+ */
+ssize_t IO::ReadFromCache (char *buff, long long off, int size, long long &ram_bytes)
+{
+    ram_bytes = 0;
+    RamCache &ram = Factory::GetInstance().GetRamCache();
+    long long blockSize = CacheBlockSize();
+    if (!ram.IsEnabled() || blockSize != ram.GetBlockSize() || m_cache_path.empty())
+        return ReadFromDisk(buff, off, size);
+
+    long long pos = off, end = off + size;
+    while (pos < end)
+    {
+        int block = pos / blockSize;
+        long long block_off = block * blockSize;
+        long long len = std::min(block_off + blockSize, end) - pos;
+        char *dest = buff + (pos - off);
+        if (ram.Read(m_cache_path, block, pos - block_off, dest, len))
+        {
+            ram_bytes += len;
+            pos += len;
+            continue;
+        }
+        if (CachedRun(pos, len) < len)
+            break;
+        if (LoadIntoRam(block, pos, dest, len))
+        {
+            pos += len;
+            continue;
+        }
+        ssize_t retval = ReadFromDisk(dest, pos, len);
+        if (retval <= 0)
+            return (pos > off) ? pos - off : retval;
+        pos += retval;
+        if (retval < len)
+            break;
+    }
+    return pos - off;
+}
+
+/*
+ * If the RAM cache admits block, read all of it from disk into the RAM
+ * cache and copy [off, off+size) of it, which lies within the block, to
+ * buff.  Returns false, having copied nothing, otherwise.
+ */
+bool IO::LoadIntoRam (int block, long long off, char *buff, long long size)
+{
+    RamCache &ram = Factory::GetInstance().GetRamCache();
+    if (!ram.Admit(m_cache_path, block))
+        return false;
+    long long blockSize = ram.GetBlockSize();
+    long long block_off = block * blockSize;
+    long long length = std::min(blockSize, m_io.FSize() - block_off);
+    BufferPool::Buffer data(length);
+    if (ReadFromDisk(data.Get(), block_off, length) != length)
+        return false;
+    ram.Insert(m_cache_path, block, data.Get(), length);
+    memcpy(buff, data.Get() + (off - block_off), size);
+    return true;
+}
+
+long long IO::CacheBlockSize ()
+{
+    if (m_cached_file)
+       return m_cached_file->GetInfo().GetBlockSize();
+    else if (m_prefetch)
+       return m_prefetch->GetBlockSize();
+    return 0;
+}
+
+/*
+ * Read the run of cached bytes starting at off from the complete or
+ * partial disk file, or from the Prefetch.  Returns 0 if the block at off
+ * is not cached.
+ */
+ssize_t IO::ReadFromDisk (char *buff, long long off, int size)
+{
+    if (m_cached_file)
+    {
+       TRACE(kDump, "IO::ReadFromCache", "disk offset size", off, size);
+       return m_cached_file->Read(buff, off, size);
+    }
+    else if (m_prefetch)
+    {
+       // The Prefetch keeps its data file open after it completes, so
+       // there is no need to reopen the finished file here.
+       TRACE(kDump, "IO::ReadFromCache", "prefetch offset size", off, size);
+       return m_prefetch->Read(buff, off, size);
+    }
+    return 0;
+}
+
+long long IO::CachedRun (long long off, int size)
+{
+    if (m_cached_file)
+       return m_cached_file->CachedRun(off, size);
+    else if (m_prefetch)
+       return m_prefetch->CachedRun(off, size);
+    return 0;
+}
+
+#if defined(HAVE_READV)
+ssize_t IO::ReadVFromCache (XrdOucIOVec *readV, int n)
+{
+    if (m_cached_file)
+       return m_cached_file->ReadV(readV, n);
+    else if (m_prefetch)
+       return m_prefetch->ReadV(readV, n);
+    errno = EBADF;
+    return -errno;
+}
+#endif
+
+/*
+ * Fetch a range the cache does not have from the origin.  If a prefetch is
+ * in progress, the request is widened to block boundaries so that the
+ * blocks can be written back into the cache file on the way through.
+ */
+int IO::ReadMiss (char *buff, long long off, int size)
+{
+    long long blockSize = m_prefetch ? m_prefetch->GetBlockSize() : 0;
+    if (!blockSize)
+    {
+        Factory::GetInstance().GetScheduler().Acquire(size, Scheduler::kDemand);
+        return m_io.Read(buff, off, size);
+    }
+
+    long long alignedOff = off - (off % blockSize);
+    long long alignedEnd = ((off + size + blockSize - 1) / blockSize) * blockSize;
+    alignedEnd = std::min(alignedEnd, m_io.FSize());
+    if (alignedEnd <= off)
+    {
+        Factory::GetInstance().GetScheduler().Acquire(size, Scheduler::kDemand);
+        return m_io.Read(buff, off, size);
+    }
+
+    BufferPool::Buffer missBuff(alignedEnd - alignedOff);
+    Factory::GetInstance().GetScheduler().Acquire(missBuff.Size(), Scheduler::kDemand);
+    int retval = m_io.Read(missBuff.Get(), alignedOff, missBuff.Size());
+    if (retval < 0)
+        return retval;
+
+    int bytes_read = std::max(0LL, std::min(static_cast<long long>(size), alignedOff + retval - off));
+    memcpy(buff, missBuff.Get() + (off - alignedOff), bytes_read);
+    m_prefetch->WriteBlocks(missBuff.Get(), alignedOff, retval);
+    return bytes_read;
 }
 
 /*
@@ -80,50 +280,297 @@ int IO::Read (char *buff, long long off, int size)
  */
 #if defined(HAVE_READV)
 
+namespace
+{
+// Misses closer together than this are fetched as one remote chunk; the
+// bytes in between are read and thrown away.
+const long long readv_merge_gap = 16*1024;
+
+// Largest single read issued to the cache disk for coalesced hits.
+const long long disk_readv_max = 8*1024*1024;
+
+#if defined(READV_MAXCHUNKSIZE)
+const long long remote_readv_max = READV_MAXCHUNKSIZE;
+#else
+const long long remote_readv_max = disk_readv_max;
+#endif
+
+struct ReadVChunk
+{
+    long long m_offset;
+    int m_size;
+    char *m_data;
+    bool operator<(const ReadVChunk &other) const {return m_offset < other.m_offset;}
+};
+
+struct ReadVRequest
+{
+    long long m_offset;
+    long long m_end;
+    std::vector<ReadVChunk> m_chunks;
+};
+
+// Staging buffers borrowed from the pool, one slot per request; the slots
+// of requests read in place stay empty.
+class Staging
+{
+public:
+    ~Staging()
+    {
+        for (size_t i = 0; i < m_buffers.size(); i++)
+            delete m_buffers[i];
+    }
+    void Resize(size_t n) {m_buffers.resize(n, NULL);}
+    char *Borrow(size_t i, size_t size)
+    {
+        m_buffers[i] = new BufferPool::Buffer(size);
+        return m_buffers[i]->Get();
+    }
+    const char *Get(size_t i) const {return m_buffers[i] ? m_buffers[i]->Get() : NULL;}
+private:
+    std::vector<BufferPool::Buffer *> m_buffers;
+};
+
+// Append a range, extending the previous one if it continues it both in
+// the file and in the caller's buffer.
+void AddChunk(std::vector<ReadVChunk> &chunks, long long offset, int size, char *data)
+{
+    if (!chunks.empty() && chunks.back().m_data + chunks.back().m_size == data &&
+        chunks.back().m_offset + chunks.back().m_size == offset)
+    {
+        chunks.back().m_size += size;
+        return;
+    }
+    ReadVChunk chunk;
+    chunk.m_offset = offset;
+    chunk.m_size = size;
+    chunk.m_data = data;
+    chunks.push_back(chunk);
+}
+
+// Sort the chunks and merge those at most gap bytes apart into requests
+// of at most max_size bytes.
+void MergeChunks(std::vector<ReadVChunk> &chunks, long long gap, long long max_size, std::vector<ReadVRequest> &requests)
+{
+    std::sort(chunks.begin(), chunks.end());
+    for (std::vector<ReadVChunk>::const_iterator it = chunks.begin(); it != chunks.end(); ++it)
+    {
+        long long chunk_end = it->m_offset + it->m_size;
+        if (!requests.empty())
+        {
+            ReadVRequest &last = requests.back();
+            long long merged_end = std::max(last.m_end, chunk_end);
+            if (it->m_offset <= last.m_end + gap && merged_end - last.m_offset <= max_size)
+            {
+                last.m_end = merged_end;
+                last.m_chunks.push_back(*it);
+                continue;
+            }
+        }
+        ReadVRequest request;
+        request.m_offset = it->m_offset;
+        request.m_end = chunk_end;
+        request.m_chunks.push_back(*it);
+        requests.push_back(request);
+    }
+}
+
+// Widen requests to whole blocks, so that what the origin returns can be
+// written back into the cache file.  A request which would then grow past
+// max_size is left alone.
+void AlignRequests(std::vector<ReadVRequest> &requests, long long blockSize, long long fileSize, long long max_size)
+{
+    for (std::vector<ReadVRequest>::iterator it = requests.begin(); it != requests.end(); ++it)
+    {
+        long long offset = it->m_offset - it->m_offset % blockSize;
+        long long end = std::min(fileSize, ((it->m_end + blockSize - 1) / blockSize) * blockSize);
+        if (end - offset <= max_size)
+        {
+            it->m_offset = offset;
+            it->m_end = std::max(end, it->m_end);
+        }
+    }
+}
+
+// Requests for a single chunk covering all of them read straight into the
+// caller's buffer; the rest go through a staging buffer.  Returns the
+// bytes requested.
+long long BuildIOVec(const std::vector<ReadVRequest> &requests, Staging &staging, std::vector<XrdOucIOVec> &readV)
+{
+    long long bytes = 0;
+    staging.Resize(requests.size());
+    readV.resize(requests.size());
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        readV[i].offset = requests[i].m_offset;
+        readV[i].size = requests[i].m_end - requests[i].m_offset;
+        readV[i].info = 0;
+        if (requests[i].m_chunks.size() == 1 && requests[i].m_chunks[0].m_offset == requests[i].m_offset &&
+            requests[i].m_chunks[0].m_size == readV[i].size)
+        {
+            readV[i].data = requests[i].m_chunks[0].m_data;
+        }
+        else
+        {
+            readV[i].data = staging.Borrow(i, readV[i].size);
+        }
+        bytes += readV[i].size;
+    }
+    return bytes;
+}
+
+void Scatter(const std::vector<ReadVRequest> &requests, const Staging &staging)
+{
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        const char *data = staging.Get(i);
+        if (!data)
+            continue;
+        for (std::vector<ReadVChunk>::const_iterator it = requests[i].m_chunks.begin(); it != requests[i].m_chunks.end(); ++it)
+            memcpy(it->m_data, data + (it->m_offset - requests[i].m_offset), it->m_size);
+    }
+}
+}
+
+/*
+ * Every byte of every chunk that is in the cache is read locally, with all
+ * the hits sorted, coalesced and issued as one vectored disk read.  The
+ * uncovered sub-ranges are merged with their neighbours into larger remote
+ * chunks.  Merged reads land in staging buffers and are scattered back
+ * into the caller's buffers.  As in ReadMiss, remote chunks of a file
+ * being cached are widened to block boundaries and the blocks written
+ * back.
+ */
 int IO::ReadV (const XrdOucIOVec *readV, int n)
 {
-    printf("======== IO::ReadV \n");
-    ssize_t bytes_read = 0;
-    size_t missing = 0;
-    XrdOucIOVec missingReadV[READV_MAXCHUNKS];
-    for (size_t i=0; i<n; i++)
+    long long start = Histogram::Now();
+    long long blockSize = CacheBlockSize();
+    RamCache &ram = Factory::GetInstance().GetRamCache();
+    bool use_ram = ram.IsEnabled() && blockSize == ram.GetBlockSize() && !m_cache_path.empty();
+    long long ram_bytes = 0, loaded_bytes = 0;
+    if (m_prefetch && n > 0)
+    {
+        long long lo = readV[0].offset, hi = readV[0].offset + readV[0].size;
+        for (int i=1; i<n; i++)
+        {
+            lo = std::min(lo, readV[i].offset);
+            hi = std::max(hi, readV[i].offset + readV[i].size);
+        }
+        XrdSysMutexHelper lock(m_pattern_mutex);
+        m_pattern.RecordV(lo, hi);
+    }
+    Readahead();
+
+    std::vector<ReadVChunk> hits, misses;
+    for (int i=0; i<n; i++)
     {
         XrdSfsXferSize size = readV[i].size;
         char * buff = readV[i].data;
         XrdSfsFileOffset off = readV[i].offset;
-        if (m_prefetch)
+        XrdSfsFileOffset end = off + size;
+        XrdSfsFileOffset pos = off;
+        while (pos < end)
         {
-           ssize_t retval = m_prefetch->Read(buff, off, size);
-           if ((retval > 0) && (retval == size))
-           {
-               // TODO: could handle partial reads here
-               bytes_read += size;
-               continue;
-           }
-        }
-        missingReadV[missing].size = size;
-        missingReadV[missing].data = buff;
-        missingReadV[missing].offset = off;
-        missing ++;
-        if (missing >= READV_MAXCHUNKS)
-        {   // Something went wrong in construction of this request;
-            // Should be limited in higher layers to a max of 512 chunks.
-            return -1;
+            long long run = CachedRun(pos, end - pos);
+            if (run > 0 && use_ram)
+            {
+                // Blocks resident in RAM, or admitted to it now, are
+                // copied here; the rest go to the disk readv.
+                for (XrdSfsFileOffset run_end = pos + run; pos < run_end; )
+                {
+                    int block = pos / blockSize;
+                    long long block_off = block * blockSize;
+                    long long len = std::min(block_off + blockSize, static_cast<long long>(run_end)) - pos;
+                    if (ram.Read(m_cache_path, block, pos - block_off, buff + (pos - off), len))
+                        ram_bytes += len;
+                    else if (LoadIntoRam(block, pos, buff + (pos - off), len))
+                        loaded_bytes += len;
+                    else
+                        AddChunk(hits, pos, len, buff + (pos - off));
+                    pos += len;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                AddChunk(hits, pos, run, buff + (pos - off));
+                pos += run;
+                continue;
+            }
+            // The block at pos is missing; the next one may not be.
+            XrdSfsFileOffset miss_end = blockSize ? std::min(end, (pos / blockSize + 1) * blockSize) : end;
+            AddChunk(misses, pos, miss_end - pos, buff + (pos - off));
+            pos = miss_end;
         }
     }
-    if (missing)
+
+    ssize_t bytes_read = ram_bytes + loaded_bytes;
+    if (!hits.empty())
     {
-        ssize_t retval = m_io.ReadV(missingReadV, missing);
-        if (retval >= 0)
+        std::vector<ReadVRequest> requests;
+        Staging staging;
+        std::vector<XrdOucIOVec> diskReadV;
+        MergeChunks(hits, 0, disk_readv_max, requests);
+        BuildIOVec(requests, staging, diskReadV);
+        if (ReadVFromCache(&diskReadV[0], diskReadV.size()) < 0)
         {
-            return retval + bytes_read;
+            m_log.Emsg("ReadV", errno, "read cached chunks of", m_io.Path());
+            misses.insert(misses.end(), hits.begin(), hits.end());
         }
         else
+        {
+            Scatter(requests, staging);
+            for (std::vector<ReadVChunk>::const_iterator it = hits.begin(); it != hits.end(); ++it)
+                bytes_read += it->m_size;
+        }
+    }
+    if (misses.empty())
+    {
+        Factory::GetInstance().GetStatistics().AddRead(CacheSource(), ram_bytes, bytes_read, bytes_read, true, Histogram::Now() - start);
+        return bytes_read;
+    }
+
+    long long missing_bytes = 0;
+    for (std::vector<ReadVChunk>::const_iterator it = misses.begin(); it != misses.end(); ++it)
+        missing_bytes += it->m_size;
+
+    std::vector<ReadVRequest> requests;
+    Staging staging;
+    std::vector<XrdOucIOVec> remoteReadV;
+    MergeChunks(misses, readv_merge_gap, remote_readv_max, requests);
+    long long fillBlockSize = m_prefetch ? m_prefetch->GetBlockSize() : 0;
+    if (fillBlockSize)
+        AlignRequests(requests, fillBlockSize, m_io.FSize(), remote_readv_max);
+    long long remote_bytes = BuildIOVec(requests, staging, remoteReadV);
+
+    Factory::GetInstance().GetScheduler().Acquire(remote_bytes, Scheduler::kDemand);
+    long long remote_read = 0;
+    for (size_t first = 0; first < remoteReadV.size(); first += READV_MAXCHUNKS)
+    {
+        int count = std::min(remoteReadV.size() - first, static_cast<size_t>(READV_MAXCHUNKS));
+        ssize_t retval = m_io.ReadV(&remoteReadV[first], count);
+        if (retval < 0)
         {
             return retval;
         }
+        remote_read += retval;
     }
-    return bytes_read;
+    // The origin does not say which chunks came up short, so none of
+    // them can be trusted.
+    if (remote_read < remote_bytes)
+    {
+        m_log.Emsg("ReadV", "Short vector read from origin; file size changed?", m_io.Path());
+        return -EIO;
+    }
+
+    Scatter(requests, staging);
+    if (fillBlockSize)
+    {
+        for (size_t i = 0; i < remoteReadV.size(); i++)
+            if (remoteReadV[i].offset % fillBlockSize == 0)
+                m_prefetch->WriteBlocks(remoteReadV[i].data, remoteReadV[i].offset, remoteReadV[i].size);
+    }
+    Factory::GetInstance().GetStatistics().AddRead(CacheSource(), ram_bytes, bytes_read, bytes_read + missing_bytes, true, Histogram::Now() - start);
+    return bytes_read + missing_bytes;
 }
 #endif
-
@@ -15,6 +15,8 @@
 #include "XrdSys/XrdSysPthread.hh"
 
 #include "XrdFileCacheFwd.hh"
+#include "AccessPattern.hh"
+#include "Statistics.hh"
 
 class XrdSysError;
 
@@ -49,17 +51,33 @@ public:
     int Write(char *Buffer, long long Offset, int Length) { errno = ENOTSUP; return -1; }
 
 protected:
-    IO(XrdOucCacheIO &io, XrdOucCacheStats &stats, Cache &cache, PrefetchPtr pread, XrdSysError &);
+    IO(XrdOucCacheIO &io, XrdOucCacheStats &stats, Cache &cache, PrefetchPtr pread, CachedFilePtr cached, XrdSysError &);
 
 private:
 
-    ~IO() {}
+    ~IO();
+    Statistics::Counter CacheSource() const {return m_cached_file ? Statistics::kBytesDisk : Statistics::kBytesPrefetch;}
     int Read (XrdOucCacheStats &Now, char *Buffer, long long Offs, int Length);
+    ssize_t ReadFromCache (char *Buffer, long long Offs, int Length, long long &RamBytes);
+    ssize_t ReadFromDisk (char *Buffer, long long Offs, int Length);
+    bool LoadIntoRam (int Block, long long Offs, char *Buffer, long long Length);
+    long long CacheBlockSize ();
+    long long CachedRun (long long Offs, int Length);
+#if defined(HAVE_READV)
+    ssize_t ReadVFromCache (XrdOucIOVec *readV, int n);
+#endif
+    int ReadMiss (char *Buffer, long long Offs, int Length);
+    void Readahead ();
 
     XrdOucCacheIO & m_io;
     XrdOucCacheStats & m_stats;
     PrefetchPtr m_prefetch;
+    CachedFilePtr m_cached_file;
     Cache & m_cache;
+    XrdSysMutex m_pattern_mutex;
+    AccessPattern m_pattern;
+    bool m_full_requested;
+    std::string m_cache_path;
     XrdSysError m_log;
 
 };
@@ -0,0 +1,144 @@
+
+#include <algorithm>
+
+#include "XrdOss/XrdOss.hh"
+
+#include "Info.hh"
+
+using namespace XrdFileCache;
+
+const char *Info::m_suffix = ".cinfo";
+const int Info::m_version = 2;
+
+Info::Info()
+    : m_block_size(0),
+      m_file_size(0),
+      m_num_blocks(0),
+      m_blocks_present(0)
+{
+}
+
+void
+Info::Init(long long fileSize, long long blockSize)
+{
+    m_block_size = blockSize;
+    m_file_size = fileSize;
+    m_num_blocks = (fileSize + blockSize - 1) / blockSize;
+    m_blocks_present = 0;
+    m_bits.assign((m_num_blocks + 7) / 8, 0);
+    m_verified.assign(m_bits.size(), 0);
+    m_checksums.assign(m_num_blocks, 0);
+}
+
+void
+Info::ClearBlockPresent(int i)
+{
+    if (!TestBlock(i))
+        return;
+    unsigned char mask = ~static_cast<unsigned char>(1 << (i%8));
+    __sync_fetch_and_and(&m_verified[i/8], mask);
+    __sync_fetch_and_and(&m_bits[i/8], mask);
+    __atomic_sub_fetch(&m_blocks_present, 1, __ATOMIC_RELEASE);
+}
+
+long long
+Info::GetBlockLength(int i) const
+{
+    long long off = i * m_block_size;
+    return (off + m_block_size > m_file_size) ? m_file_size - off : m_block_size;
+}
+
+long long
+Info::GetBytesPresent() const
+{
+    long long bytes = GetBlocksPresent() * m_block_size;
+    if (m_num_blocks && TestBlock(m_num_blocks - 1))
+        bytes -= m_block_size - GetBlockLength(m_num_blocks - 1);
+    return bytes;
+}
+
+long long
+Info::GetCachedRun(long long offset, long long size) const
+{
+    long long end = std::min(offset + size, m_file_size);
+    if (end <= offset)
+        return 0;
+    if (IsComplete())
+        return end - offset;
+
+    long long available = offset;
+    for (int block = offset / m_block_size; available < end; ++block)
+    {
+        if (!TestBlock(block))
+            break;
+        available = std::min((block + 1) * m_block_size, end);
+    }
+    return available - offset;
+}
+
+/*
+ * On-disk layout, all fields in host byte order:
+ *
+ *   int       version
+ *   long long block size
+ *   long long file size
+ *   char[]    bitmap, one bit per block
+ *   int[]     CRC32C of each block, meaningful for present blocks only
+ *
+ * Files written by older versions are rejected, so their data is fetched
+ * again.
+ */
+bool
+Info::Read(XrdOssDF *fp)
+{
+    off_t off = 0;
+    int version;
+    if (fp->Read(&version, off, sizeof(int)) != sizeof(int) || version != m_version)
+        return false;
+    off += sizeof(int);
+
+    long long blockSize, fileSize;
+    if (fp->Read(&blockSize, off, sizeof(long long)) != sizeof(long long) || blockSize <= 0)
+        return false;
+    off += sizeof(long long);
+    if (fp->Read(&fileSize, off, sizeof(long long)) != sizeof(long long) || fileSize < 0)
+        return false;
+    off += sizeof(long long);
+
+    Init(fileSize, blockSize);
+    if (m_bits.empty())
+        return true;
+    ssize_t crcSize = m_checksums.size() * sizeof(unsigned int);
+    if (fp->Read(&m_bits[0], off, m_bits.size()) != static_cast<ssize_t>(m_bits.size()) ||
+        fp->Read(&m_checksums[0], off + m_bits.size(), crcSize) != crcSize)
+    {
+        Init(fileSize, blockSize);
+        return false;
+    }
+
+    for (int i = 0; i < m_num_blocks; ++i)
+        if (TestBlock(i)) m_blocks_present++;
+    return true;
+}
+
+bool
+Info::Write(XrdOssDF *fp) const
+{
+    off_t off = 0;
+    if (fp->Write(&m_version, off, sizeof(int)) != sizeof(int))
+        return false;
+    off += sizeof(int);
+    if (fp->Write(&m_block_size, off, sizeof(long long)) != sizeof(long long))
+        return false;
+    off += sizeof(long long);
+    if (fp->Write(&m_file_size, off, sizeof(long long)) != sizeof(long long))
+        return false;
+    off += sizeof(long long);
+    if (m_bits.empty())
+        return true;
+    if (fp->Write(&m_bits[0], off, m_bits.size()) != static_cast<ssize_t>(m_bits.size()))
+        return false;
+    off += m_bits.size();
+    ssize_t crcSize = m_checksums.size() * sizeof(unsigned int);
+    return fp->Write(&m_checksums[0], off, crcSize) == crcSize;
+}
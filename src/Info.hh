@@ -0,0 +1,96 @@
+#ifndef __XRDFILECACHE_INFO_HH__
+#define __XRDFILECACHE_INFO_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * Companion metadata for a cached file.  Each data file in the cache has an
+ * info file next to it holding the block size, the size of the origin file,
+ * a bitmap of the blocks which have been written into the data file and a
+ * CRC32C of each of those blocks.
+ *
+ * Blocks loaded from an info file are not trusted until their data has
+ * been checked against the checksum; a second, in-memory bitmap records
+ * the blocks which have been checked or written since.
+ */
+
+#include <string>
+#include <vector>
+
+class XrdOssDF;
+
+namespace XrdFileCache {
+
+class Info
+{
+
+public:
+
+    Info();
+
+    // Set up an empty bitmap for a file of the given size.
+    void Init(long long fileSize, long long blockSize);
+
+    // Read the info from the start of an open file; returns false if the
+    // file is empty or does not contain a valid header.
+    bool Read(XrdOssDF *fp);
+    bool Write(XrdOssDF *fp) const;
+
+    // Bits may be tested without holding any lock while they are being set.
+    inline void SetBlock(int i) {__sync_fetch_and_or(&m_bits[i/8], static_cast<unsigned char>(1 << (i%8)));}
+    inline bool TestBlock(int i) const {return __atomic_load_n(&m_bits[i/8], __ATOMIC_ACQUIRE) & (1 << (i%8));}
+
+    // The count of present blocks may be read without holding any lock,
+    // like the bits; it is changed after them.
+    bool IsComplete() const {return __atomic_load_n(&m_blocks_present, __ATOMIC_ACQUIRE) == m_num_blocks;}
+    void SetBlockPresent(int i) {if (!TestBlock(i)) {SetBlock(i); __atomic_add_fetch(&m_blocks_present, 1, __ATOMIC_RELEASE);}}
+
+    // Forget a block whose data turned out to be bad.  The caller
+    // serializes this with SetBlockPresent.
+    void ClearBlockPresent(int i);
+
+    // Set before the block is marked present; read after testing it.
+    void SetChecksum(int i, unsigned int crc) {m_checksums[i] = crc;}
+    unsigned int GetChecksum(int i) const {return m_checksums[i];}
+
+    inline void SetVerified(int i) {__sync_fetch_and_or(&m_verified[i/8], static_cast<unsigned char>(1 << (i%8)));}
+    inline bool TestVerified(int i) const {return __atomic_load_n(&m_verified[i/8], __ATOMIC_ACQUIRE) & (1 << (i%8));}
+
+    int GetNumBlocks() const {return m_num_blocks;}
+    int GetBlocksPresent() const {return __atomic_load_n(&m_blocks_present, __ATOMIC_RELAXED);}
+    long long GetBlockSize() const {return m_block_size;}
+    long long GetFileSize() const {return m_file_size;}
+
+    // Size of block i; only the last block may be short.
+    long long GetBlockLength(int i) const;
+
+    long long GetBytesPresent() const;
+
+    // Length of the run of present bytes starting at offset, at most size
+    // and never past the end of the file; 0 if the block at offset is
+    // missing.
+    long long GetCachedRun(long long offset, long long size) const;
+
+    static const char *m_suffix;
+
+private:
+
+    static const int m_version;
+
+    long long m_block_size;
+    long long m_file_size;
+    int m_num_blocks;
+    int m_blocks_present;
+    std::vector<unsigned char> m_bits;
+    std::vector<unsigned char> m_verified;
+    std::vector<unsigned int> m_checksums;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,355 @@
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Decision.hh"
+
+#include "XrdSys/XrdSysError.hh"
+#include "XrdSys/XrdSysPthread.hh"
+#include "XrdOuc/XrdOucEnv.hh"
+#include "XrdOuc/XrdOucStream.hh"
+#include "XrdOuc/XrdOuca2x.hh"
+
+/*
+  A decision plugin which only caches files that are asked for again: a
+  file is admitted once it has been opened a number of times within a
+  time window, or straight away if it is small.  A single pass over a
+  large dataset therefore leaves the working set in the cache alone.
+
+  Opens are counted in a count-min sketch, a few rows of small saturating
+  counters indexed by independent hashes of the path; the estimate for a
+  path is the smallest of its counters.  Estimates can only be too high,
+  by an amount which shrinks as the rows get wider, and the memory used
+  does not depend on the number of paths.  The window is covered by two
+  sketches: opens go into the current one, estimates add up both, and
+  every window the older one is cleared and becomes current.  An open is
+  thus remembered for at least one window and at most two.
+
+  Given a state file, the sketches are saved to it every few minutes and
+  reloaded from it on startup.
+
+  Parameters, after the library name on the decisionlib directive:
+
+    -hits <n>       opens within the window needed for admission; default 2
+    -window <time>  default 1h
+    -small <size>   files up to this size are always admitted; default 0,
+                    meaning none are
+    -width <n>      counters per row; default 1048576, which with the
+                    default depth takes 8 MB for the two sketches
+    -depth <n>      rows; default 4
+    -state <path>   file to keep the sketches in across restarts
+    -save <time>    how often to save the state between rotations;
+                    default 5m
+ */
+
+namespace
+{
+
+const unsigned int state_magic = 0x58464350; // "XFCP"
+const unsigned int state_version = 1;
+
+// FNV-1a with a 64-bit finalizer; stable across builds, which the state
+// file relies on.
+unsigned long long Hash(const std::string &path)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < path.size(); i++)
+        h = (h ^ static_cast<unsigned char>(path[i])) * 1099511628211ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void *SaveThread(void *);
+
+}
+
+class PopularityDecision : public XrdFileCache::Decision2 {
+
+public:
+
+    PopularityDecision(XrdSysError &log)
+        : m_log(log),
+          m_hits(2),
+          m_window(3600),
+          m_small(0),
+          m_width(1024*1024),
+          m_depth(4),
+          m_save_interval(300),
+          m_current(0),
+          m_rotated(time(0))
+    {
+        m_counters.assign(2 * SketchSize(), 0);
+    }
+
+    virtual bool Decide(std::string &path, XrdOss &oss) const {return DecideFile(path, -1, oss);}
+
+    virtual bool DecideFile(std::string &path, long long size, XrdOss &) const
+    {
+        unsigned long long h = Hash(path);
+        XrdSysMutexHelper lock(&m_mutex);
+        Rotate(time(0));
+        int seen = Record(h);
+        return seen >= m_hits || (size >= 0 && size <= m_small);
+    }
+
+    virtual bool ConfigDecision(const char *parms);
+
+    // Every open counts, so no verdict may be reused.
+    virtual int GetCacheTime() const {return 0;}
+
+    void SaveLoop();
+
+private:
+
+    // Sketches can exceed 2 GB, so offsets are worked out in size_t.
+    size_t SketchSize() const {return static_cast<size_t>(m_depth) * m_width;}
+    unsigned char *Row(int sketch, int row) const {return &m_counters[(static_cast<size_t>(sketch) * m_depth + row) * m_width];}
+    size_t Index(unsigned long long h, int row) const {return ((h & 0xffffffffULL) + row * ((h >> 32) | 1)) % m_width;}
+
+    int Record(unsigned long long h) const;
+    void Rotate(time_t now) const;
+    bool Load();
+    bool Save();
+
+    XrdSysError &m_log;
+    int m_hits;
+    int m_window;
+    long long m_small;
+    int m_width;
+    int m_depth;
+    std::string m_state_file;
+    int m_save_interval;
+
+    // Decide is const; the counters are what it keeps track of.
+    mutable XrdSysMutex m_mutex;
+    mutable std::vector<unsigned char> m_counters; // two sketches of depth rows
+    mutable int m_current;
+    mutable time_t m_rotated;
+
+};
+
+/*
+ * Count an open in the current sketch and return the estimate of opens
+ * over both.  Conservative update: only the counters at the current
+ * minimum are raised, which keeps the estimates of other paths sharing
+ * the rest from growing.  Must be called with m_mutex held.
+ */
+int
+PopularityDecision::Record(unsigned long long h) const
+{
+    int current_min = 255, total_min = 2 * 255;
+    std::vector<size_t> index(m_depth);
+    for (int row = 0; row < m_depth; row++)
+    {
+        index[row] = Index(h, row);
+        int current = Row(m_current, row)[index[row]];
+        int total = current + Row(1 - m_current, row)[index[row]];
+        if (current < current_min) current_min = current;
+        if (total < total_min) total_min = total;
+    }
+    if (current_min == 255)
+        return total_min;
+    for (int row = 0; row < m_depth; row++)
+    {
+        unsigned char &counter = Row(m_current, row)[index[row]];
+        if (counter == current_min)
+            counter++;
+    }
+    return total_min + 1;
+}
+
+// Must be called with m_mutex held.
+void
+PopularityDecision::Rotate(time_t now) const
+{
+    if (now - m_rotated < m_window)
+        return;
+    // Idle for two windows or more: both sketches are stale.
+    if (now - m_rotated >= 2 * m_window)
+        memset(Row(1 - m_current, 0), 0, SketchSize());
+    m_current = 1 - m_current;
+    memset(Row(m_current, 0), 0, SketchSize());
+    m_rotated = now;
+}
+
+/*
+ * State file layout, host byte order:
+ *
+ *   unsigned int  magic, version
+ *   int           width, depth, window, current sketch
+ *   long long     time of the last rotation
+ *   char[]        both sketches
+ *
+ * A file written with a different geometry or window is ignored.
+ */
+bool
+PopularityDecision::Load()
+{
+    FILE *fp = fopen(m_state_file.c_str(), "r");
+    if (!fp)
+        return false;
+    unsigned int header[2];
+    int geometry[4];
+    long long rotated;
+    bool ok = fread(header, sizeof(header), 1, fp) == 1 && header[0] == state_magic && header[1] == state_version &&
+              fread(geometry, sizeof(geometry), 1, fp) == 1 && geometry[0] == m_width && geometry[1] == m_depth &&
+              geometry[2] == m_window && (geometry[3] == 0 || geometry[3] == 1) &&
+              fread(&rotated, sizeof(rotated), 1, fp) == 1;
+    std::vector<unsigned char> counters(m_counters.size());
+    ok = ok && fread(&counters[0], counters.size(), 1, fp) == 1;
+    fclose(fp);
+    if (!ok)
+    {
+        m_log.Emsg("PopularityDecision", "Ignoring unusable state file", m_state_file.c_str());
+        return false;
+    }
+
+    XrdSysMutexHelper lock(&m_mutex);
+    m_counters.swap(counters);
+    m_current = geometry[3];
+    m_rotated = rotated;
+    Rotate(time(0));
+    return true;
+}
+
+// Written next to the state file and renamed into place.
+bool
+PopularityDecision::Save()
+{
+    std::vector<unsigned char> counters;
+    int geometry[4] = {m_width, m_depth, m_window, 0};
+    long long rotated;
+    {
+        XrdSysMutexHelper lock(&m_mutex);
+        Rotate(time(0));
+        counters = m_counters;
+        geometry[3] = m_current;
+        rotated = m_rotated;
+    }
+
+    unsigned int header[2] = {state_magic, state_version};
+    std::string tmp_path = m_state_file + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "w");
+    bool ok = fp && fwrite(header, sizeof(header), 1, fp) == 1 && fwrite(geometry, sizeof(geometry), 1, fp) == 1 &&
+              fwrite(&rotated, sizeof(rotated), 1, fp) == 1 && fwrite(&counters[0], counters.size(), 1, fp) == 1;
+    if (fp && fclose(fp))
+        ok = false;
+    if (!ok || rename(tmp_path.c_str(), m_state_file.c_str()) < 0)
+    {
+        m_log.Emsg("PopularityDecision", errno, "save state to", m_state_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+void
+PopularityDecision::SaveLoop()
+{
+    int interval = std::min(m_save_interval, m_window);
+    while (1)
+    {
+        sleep(interval);
+        Save();
+    }
+}
+
+namespace
+{
+void *SaveThread(void *decision)
+{
+    static_cast<PopularityDecision *>(decision)->SaveLoop();
+    return NULL;
+}
+}
+
+bool
+PopularityDecision::ConfigDecision(const char *parms)
+{
+    XrdOucEnv myEnv;
+    XrdOucStream Config(&m_log, getenv("XRDINSTANCE"), &myEnv, "=====> ");
+    Config.Put(parms);
+
+    char *val;
+    while ((val = Config.GetWord()))
+    {
+        std::string opt = val;
+        if (!(val = Config.GetWord()))
+        {
+            m_log.Emsg("PopularityDecision", "No value given for", opt.c_str());
+            return false;
+        }
+        long long size;
+        if (opt == "-hits")
+        {
+            if (XrdOuca2x::a2i(m_log, "hits", val, &m_hits, 1, 255)) return false;
+        }
+        else if (opt == "-window")
+        {
+            if (XrdOuca2x::a2tm(m_log, "window", val, &m_window, 1)) return false;
+        }
+        else if (opt == "-small")
+        {
+            if (XrdOuca2x::a2sz(m_log, "small", val, &m_small, 0)) return false;
+        }
+        else if (opt == "-width")
+        {
+            if (XrdOuca2x::a2sz(m_log, "width", val, &size, 1024, 1LL << 30)) return false;
+            m_width = size;
+        }
+        else if (opt == "-depth")
+        {
+            if (XrdOuca2x::a2i(m_log, "depth", val, &m_depth, 1, 16)) return false;
+        }
+        else if (opt == "-state")
+        {
+            m_state_file = val;
+        }
+        else if (opt == "-save")
+        {
+            if (XrdOuca2x::a2tm(m_log, "save", val, &m_save_interval, 1)) return false;
+        }
+        else
+        {
+            m_log.Emsg("PopularityDecision", "Unknown parameter", opt.c_str());
+            return false;
+        }
+    }
+
+    m_counters.assign(2 * SketchSize(), 0);
+    m_current = 0;
+    m_rotated = time(0);
+
+    if (!m_state_file.empty())
+    {
+        if (Load())
+            m_log.Emsg("PopularityDecision", "Loaded state from", m_state_file.c_str());
+        pthread_t tid;
+        if (XrdSysThread::Run(&tid, SaveThread, (void *)this, 0, "XrdFileCache PopularityDecision"))
+            m_log.Emsg("PopularityDecision", errno, "start state saving thread");
+    }
+    return true;
+}
+
+/******************************************************************************/
+/*                          XrdFileCacheGetDecision                           */
+/******************************************************************************/
+
+// Return a decision object to use.
+extern "C"
+{
+XrdFileCache::Decision * XrdFileCacheGetDecision(XrdSysError &log)
+{
+    return new PopularityDecision(log);
+}
+}
@@ -1,36 +1,63 @@
 
 #include <vector>
-#include <stdio.h>
+#include <algorithm>
 #include <sstream>
 #include <fcntl.h>
+#include <errno.h>
 
 #include "Prefetch.hh"
 #include "Factory.hh"
 #include "Cache.hh"
+#include "Scheduler.hh"
+#include "Catalog.hh"
+#include "Trace.hh"
+#include "Statistics.hh"
+#include "BufferPool.hh"
+#include "DirectIO.hh"
+#include "Crc32c.hh"
 
 #include "XrdSfs/XrdSfsInterface.hh"
 #include "XrdOuc/XrdOucEnv.hh"
 
 using namespace XrdFileCache;
 
-const size_t Prefetch::m_buffer_size = 64*1024;
+// Number of blocks fetched between rewrites of the info file; bounds the
+// amount of work lost if we crash mid-prefetch.
+const int Prefetch::m_info_sync_blocks = 16;
 
-Prefetch::Prefetch(XrdSysError &log, XrdOss &outputFS, XrdOucCacheIO &inputIO)
+// Seconds since the last client read for which a file counts as active.
+const int Prefetch::m_active_window = 10;
+
+// Readahead requests remembered per file; the oldest are dropped first.
+const size_t Prefetch::m_max_wanted = 64;
+
+Prefetch::Prefetch(XrdSysError &log, XrdOss &outputFS, XrdOucCacheIO &inputIO, bool sparse)
     : m_output_fs(outputFS),
       m_output(NULL),
-      m_input(inputIO),
-      m_offset(0),
+      m_output_direct(NULL),
+      m_info_file(NULL),
+      m_blocks_since_sync(0),
+      m_next_block(0),
+      m_full(false),
+      m_sparse(sparse),
+      m_in_flight(0),
+      m_error(0),
+      m_input(&inputIO),
+      m_input_users(0),
+      m_path(inputIO.Path()),
+      m_file_size(inputIO.FSize()),
+      m_last_access(time(0)),
       m_started(false),
       m_finalized(false),
       m_stop(false),
+      m_finishing(false),
+      m_readable(false),
+      m_queued(false),
       m_cond(0), // We will explicitly lock the condition before use.
       m_log(0, "Prefetch_"),
-      m_temp_filename("")
+      m_dir(-1)
 {
     m_log.logger(log.logger());
-#if defined(HAVE_READV)
-    printf("ffffffffffffffffffffff\n");
-#endif
 }
 
 void
@@ -41,61 +68,463 @@ Prefetch::CloseCleanly()
         m_stop = true;
 }
 
+/*
+ * Origin reads go through the XrdOucCacheIO of one of the attached clients.
+ * That object goes away when its client detaches, so the prefetch switches
+ * to another reader's handle, waiting for reads already using the old one.
+ * With no readers left there is no way to reach the origin and the
+ * prefetch stops.
+ */
+void
+Prefetch::AddReader(XrdOucCacheIO *io)
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    if (std::find(m_readers.begin(), m_readers.end(), io) == m_readers.end())
+        m_readers.push_back(io);
+    if (!m_input)
+        m_input = io;
+    __atomic_store_n(&m_last_access, time(0), __ATOMIC_RELAXED);
+    // Revive a prefetch that was told to stop but has not wound down yet.
+    if (m_stop && !m_finishing && !m_finalized && (m_error == 0 || m_error == -EINTR))
+    {
+        m_stop = false;
+        m_error = 0;
+    }
+}
+
+void
+Prefetch::RemoveReader(XrdOucCacheIO *io)
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    std::vector<XrdOucCacheIO*>::iterator it = std::find(m_readers.begin(), m_readers.end(), io);
+    if (it != m_readers.end())
+        m_readers.erase(it);
+    if (m_input == io)
+    {
+        while (m_input_users)
+            m_cond.Wait();
+        m_input = m_readers.empty() ? NULL : m_readers.front();
+    }
+    if (m_readers.empty() && !m_finalized)
+    {
+        m_stop = true;
+        // Nobody else may come along to wind an idle prefetch down.
+        monitor.UnLock();
+        Finish();
+    }
+}
+
+/*
+ * Ask for the blocks covering [offset, offset+length) to be fetched ahead
+ * of the rest.  Returns true if this added blocks the file did not have.
+ */
+bool
+Prefetch::Readahead(long long offset, long long length)
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    if (!__atomic_load_n(&m_readable, __ATOMIC_ACQUIRE) || m_finalized || m_stop)
+        return false;
+    long long blockSize = m_info.GetBlockSize();
+    int first = offset / blockSize;
+    int last = std::min(static_cast<long long>(m_info.GetNumBlocks()), (offset + length + blockSize - 1) / blockSize);
+    while (first < last && m_info.TestBlock(first))
+        first++;
+    if (first >= last)
+        return false;
+    if (m_wanted.size() >= m_max_wanted)
+        m_wanted.pop_front();
+    m_wanted.push_back(std::make_pair(first, last));
+    return true;
+}
+
+/*
+ * Switch between fetching the whole file and only what Readahead asks for.
+ * A sparse file stays with the latter.
+ */
+void
+Prefetch::SetFullPrefetch(bool full)
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    m_full = full && !m_sparse;
+}
+
+/*
+ * A file is being actively read if it has readers and one of them has
+ * touched it recently; such files get readahead priority over the rest.
+ */
+bool
+Prefetch::IsActive()
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    return !m_readers.empty() && (time(0) - __atomic_load_n(&m_last_access, __ATOMIC_RELAXED) < m_active_window);
+}
+
+/*
+ * Fetch every missing block of the file in the calling thread.  Normally
+ * blocks are fetched by the Scheduler's workers; this is used when nobody
+ * picked the file up before it was destroyed.
+ */
 void
 Prefetch::Run()
 {
-    if (!Open())
-        return;
+    int block, count;
+    while ((block = GetNextBlock(count)) >= 0)
+        DoBlocks(block, count);
+    Finish();
+}
 
-    m_log.Emsg("Run", "Beginning prefetch of ", m_input.Path());
-    std::vector<char> buff;
-    buff.reserve(m_buffer_size);
+/*
+ * Claim the next run of blocks which are neither present nor already
+ * claimed, opening the cache files on first use.  Returns the first block
+ * and sets count, or returns -1 when there is nothing to do or the
+ * prefetch should stop.
+ */
+int
+Prefetch::GetNextBlock(int &count)
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    if (!m_started && !m_input)
+    {
+        // Every reader left before we got going; nothing to do.
+        m_started = true;
+        m_finalized = true;
+        m_cond.Broadcast();
+        return -1;
+    }
+    if (!m_started)
+    {
+        monitor.UnLock();
+        if (!Open())
+            return -1;
+        if (TRACE_ON(kInfo))
+            m_log.Emsg("Run", "Beginning prefetch of ", m_path.c_str());
+        monitor.Lock(&m_cond);
+    }
+    if (m_finalized)
+        return -1;
+    // Note we don't lock read-access, as this will only ever go from 0 to 1
+    if (m_stop)
+    {
+        if (!m_error)
+        {
+            if (TRACE_ON(kInfo))
+                m_log.Emsg("Read", "Stopping for a clean close of ", m_path.c_str());
+            m_error = -EINTR;
+        }
+        return -1;
+    }
 
-    int retval = 0;
-    while (0 != (retval = m_input.Read(&buff[0], m_offset, m_buffer_size)))
+    // Readahead requests first, oldest first, then the rest of the file.
+    while (!m_wanted.empty())
     {
-        if ((retval < 0) && (retval != -EINTR))
+        std::pair<int, int> &range = m_wanted.front();
+        while (range.first < range.second && (m_info.TestBlock(range.first) || m_claimed[range.first]))
+            range.first++;
+        if (range.first < range.second)
         {
-            break;
+            int block = ClaimBlocks(range.first, range.second, count);
+            range.first += count;
+            return block;
         }
+        m_wanted.pop_front();
+    }
+    if (!m_full)
+        return -1;
+    while (m_next_block < m_info.GetNumBlocks() && (m_info.TestBlock(m_next_block) || m_claimed[m_next_block]))
+        m_next_block++;
+    if (m_next_block >= m_info.GetNumBlocks())
+        return -1;
+    int block = ClaimBlocks(m_next_block, m_info.GetNumBlocks(), count);
+    m_next_block += count;
+    return block;
+}
 
-        int buffer_remaining = retval;
-        int buffer_offset = 0;
+/*
+ * Claim block and the missing, unclaimed blocks following it, stopping
+ * before limit or once the run fills a write batch.  The run counts once
+ * against the in-flight limit.  Must be called with m_cond held.
+ */
+int
+Prefetch::ClaimBlocks(int block, int limit, int &count)
+{
+    int max_count = std::max(1LL, Factory::GetInstance().GetWriteBatch() / m_info.GetBlockSize());
+    count = 0;
+    do
+    {
+        m_claimed[block + count] = true;
+        count++;
+    } while (count < max_count && block + count < limit &&
+             !m_info.TestBlock(block + count) && !m_claimed[block + count]);
+    m_in_flight++;
+    return block;
+}
 
-       while ((buffer_remaining > 0) &&  // There is more to be written
-              (((retval = m_output->Write(&buff[buffer_offset], m_offset, buffer_remaining)) != -1) || (errno == EINTR))) { // Write occurs without an error
-            buffer_remaining -= retval;
-            buffer_offset += retval;
-            __sync_fetch_and_add(&m_offset, retval);
-        }
+/*
+ * Fetch a claimed run of blocks through a pooled buffer and release the
+ * claims; the first error stops the whole prefetch.
+ */
+void
+Prefetch::DoBlocks(int block, int count)
+{
+    int retval;
+    CacheDirs &dirs = Factory::GetInstance().GetCacheDirs();
+    dirs.AddInFlight(GetCacheDir(), 1);
+    {
+        BufferPool::Buffer buff(count * m_info.GetBlockSize());
+        retval = FetchBlocks(buff.Get(), block, count);
+    }
+    dirs.AddInFlight(GetCacheDir(), -1);
+
+    XrdSysCondVarHelper monitor(m_cond);
+    for (int i = 0; i < count; i++)
+        m_claimed[block + i] = false;
+    m_in_flight--;
+    if (retval < 0)
+    {
+        if (!m_error) m_error = retval;
+        m_stop = true;
+    }
+}
+
+/*
+ * Whether the file should go back on the scheduler queue: it has blocks
+ * left to claim and fewer than the configured number in flight.  A file
+ * with nothing to do drops off the queue until Readahead is called.
+ */
+bool
+Prefetch::HasMoreWork()
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    if (!m_started)
+        return true;
+    return !m_finalized && !m_stop && (m_in_flight < Factory::GetInstance().GetInFlight()) &&
+           (!m_wanted.empty() || (m_full && m_next_block < m_info.GetNumBlocks()));
+}
+
+/*
+ * Close or fail the prefetch once it is complete or stopped and the last
+ * outstanding block has landed; a no-op otherwise.  An incomplete file
+ * that is merely idle stays open for further readahead.
+ */
+void
+Prefetch::Finish()
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    if (!m_started || m_finalized || m_finishing || m_in_flight)
+        return;
+    if (!m_stop && !m_info.IsComplete())
+        return;
+    m_finishing = true;
+    int retval = m_error;
+    if (retval < 0)
+        m_stop = true;
+    monitor.UnLock();
+
+    if (retval < 0) {
+        m_log.Emsg("Read", retval, "Failure prefetching file");
+        Fail(retval != -EINTR);
+    }
+
+    Close();
+}
+
+/*
+ * One origin read and one cache write for the whole run.
+ */
+int
+Prefetch::FetchBlocks(char *buff, int block, int count)
+{
+    off_t offset = block * m_info.GetBlockSize();
+    size_t length = (count - 1) * m_info.GetBlockSize() + m_info.GetBlockLength(block + count - 1);
+    Factory::GetInstance().GetScheduler().Acquire(length, IsActive() ? Scheduler::kReadahead : Scheduler::kBackground);
+    long long start = Histogram::Now();
+    ssize_t retval = ReadInput(buff, offset, length);
+    Factory::GetInstance().GetStatistics().AddLatency(Statistics::kPrefetchOrigin, Histogram::Now() - start);
+    if (retval < 0)
+    {
+        return retval;
+    }
+    if (static_cast<size_t>(retval) != length)
+    {
+        m_log.Emsg("Run", "Short read from origin; file size changed? ", m_path.c_str());
+        return -EIO;
+    }
+    if (!WriteToOutput(buff, offset, length))
+    {
+        Factory::GetInstance().GetCacheDirs().ReportError(m_data_filename, errno);
+        return -errno;
+    }
+    std::vector<unsigned int> crcs(count);
+    for (int i = 0; i < count; i++)
+        crcs[i] = Crc32c::Compute(buff + i * m_info.GetBlockSize(), m_info.GetBlockLength(block + i));
+    {
+        XrdSysCondVarHelper monitor(m_cond);
+        for (int i = 0; i < count; i++)
+            MarkBlockPresent(block + i, crcs[i]);
+    }
+
+    Factory::GetInstance().GetStatistics().Add(Statistics::kBytesPrefetched, length);
+    TRACE(kDebug, "Prefetch::FetchBlocks", "first count", block, count);
+    return 0;
+}
+
+/*
+ * Read from the origin through the current input, pinning it so that
+ * RemoveReader does not swap it out underneath us.
+ */
+ssize_t
+Prefetch::ReadInput(char *buff, off_t offset, size_t size)
+{
+    XrdOucCacheIO *input;
+    {
+        XrdSysCondVarHelper monitor(m_cond);
+        if (!(input = m_input))
+            return -EINTR;
+        m_input_users++;
+    }
+
+    ssize_t retval = ReadInput(input, buff, offset, size);
+
+    XrdSysCondVarHelper monitor(m_cond);
+    if (--m_input_users == 0)
+        m_cond.Broadcast();
+    return retval;
+}
+
+/*
+ * Retry short reads until the range is complete or the origin reports EOF.
+ */
+ssize_t
+Prefetch::ReadInput(XrdOucCacheIO *input, char *buff, off_t offset, size_t size)
+{
+    size_t bytes_read = 0;
+    while (bytes_read < size)
+    {
+        int retval = input->Read(buff + bytes_read, offset + bytes_read, size - bytes_read);
+        if (retval == -EINTR)
+            continue;
         if (retval < 0)
+            return retval;
+        if (retval == 0)
+            break;
+        bytes_read += retval;
+    }
+    return bytes_read;
+}
+
+/*
+ * Write a range into the data file, retrying on EINTR and short writes.
+ */
+bool
+Prefetch::WriteToOutput(const char *buff, off_t offset, size_t size)
+{
+    XrdOssDF *output = (m_output_direct && Factory::GetInstance().GetDirectFill() &&
+                        DirectIO::IsAligned(buff, offset, size)) ? m_output_direct : m_output;
+    size_t buffer_remaining = size;
+    size_t buffer_offset = 0;
+    ssize_t retval = 0;
+    while ((buffer_remaining > 0) &&  // There is more to be written
+           (((retval = output->Write(&buff[buffer_offset], offset + buffer_offset, buffer_remaining)) != -1) || (errno == EINTR))) { // Write occurs without an error
+        if (retval < 0) continue;
+        buffer_remaining -= retval;
+        buffer_offset += retval;
+    }
+    return retval >= 0;
+}
+
+/*
+ * Mark a block present with the checksum of the data written for it; must
+ * be called with m_cond held.  The info file is only rewritten every few
+ * blocks; a block is never marked present on disk before its data has
+ * been written.
+ */
+void
+Prefetch::MarkBlockPresent(int block, unsigned int crc)
+{
+    m_info.SetChecksum(block, crc);
+    m_info.SetVerified(block);
+    m_info.SetBlockPresent(block);
+    if (++m_blocks_since_sync >= m_info_sync_blocks)
+    {
+        m_info.Write(m_info_file);
+        m_blocks_since_sync = 0;
+        UpdateCatalog();
+    }
+}
+
+/*
+ * Store data fetched from the origin on behalf of a client.  Only blocks
+ * entirely contained in [offset, offset+size) are written, each run of
+ * missing blocks with a single write; offset must be block aligned, and
+ * nothing is written if it is not.
+ *
+ * The data and checksums are done without the lock, as m_output stays
+ * open until we are destroyed; only marking the blocks present takes it.
+ * A worker fetching the same blocks writes the same bytes, and whichever
+ * marks a block second leaves it alone.
+ */
+void
+Prefetch::WriteBlocks(const char *buff, off_t offset, size_t size)
+{
+    if (!__atomic_load_n(&m_readable, __ATOMIC_ACQUIRE))
+        return;
+    {
+        XrdSysCondVarHelper monitor(m_cond);
+        if (m_finalized)
+            return;
+    }
+
+    long long blockSize = m_info.GetBlockSize();
+    // Runs are copied out of buff relative to offset; an unaligned one
+    // would land in the wrong place in the file.
+    if (offset % blockSize)
+        return;
+    long long end = offset + size;
+    int block = offset / blockSize;
+    while (block < m_info.GetNumBlocks() && block * blockSize < end)
+    {
+        if (m_info.TestBlock(block))
         {
-           break;
+            block++;
+            continue;
         }
-       
-        if (m_offset % (10*1024*1024) == 0)
+        int last = block;
+        while (last < m_info.GetNumBlocks() && !m_info.TestBlock(last) &&
+               last * blockSize + m_info.GetBlockLength(last) <= end)
+            last++;
+        if (last == block)
+            break;
+
+        long long runOffset = block * blockSize;
+        long long runLength = (last - 1) * blockSize + m_info.GetBlockLength(last - 1) - runOffset;
+        if (!WriteToOutput(buff + (runOffset - offset), runOffset, runLength))
         {
-            std::stringstream ss;
-            ss << "Prefetched " << (m_offset/(1024*1024)) << " MB";
-            m_log.Emsg("Fetching", ss.str().c_str());
+            m_log.Emsg("WriteBlocks", errno, "write back blocks for", m_path.c_str());
+            Factory::GetInstance().GetCacheDirs().ReportError(m_data_filename, errno);
+            break;
         }
-        // Note we don't lock read-access, as this will only ever go from 0 to 1
-        // Reading during a partial write is OK in this case.
-        if (m_stop)
+        std::vector<unsigned int> crcs(last - block);
+        for (int i = block; i < last; i++)
+            crcs[i - block] = Crc32c::Compute(buff + (i * blockSize - offset), m_info.GetBlockLength(i));
         {
-            m_log.Emsg("Read", "Stopping for a clean close");
-            retval = -EINTR;
-            break;
+            XrdSysCondVarHelper monitor(m_cond);
+            if (m_finalized)
+                return;
+            for (int i = block; i < last; i++)
+                if (!m_info.TestBlock(i))
+                    MarkBlockPresent(i, crcs[i - block]);
         }
+        block = last;
+        Factory::GetInstance().GetStatistics().Add(Statistics::kBytesWrittenBack, runLength);
     }
+}
 
-    if (retval < 0) {
-        m_log.Emsg("Read", retval, "Failure prefetching file");
-        m_stop = true;
-        Fail(retval != -EINTR);
-    }
-
-    Close();
+long long
+Prefetch::GetBlockSize()
+{
+    if (!__atomic_load_n(&m_readable, __ATOMIC_ACQUIRE) || m_finalized)
+        return 0;
+    return m_info.GetBlockSize();
 }
 
 void
@@ -104,18 +533,18 @@ Prefetch::Join()
     XrdSysCondVarHelper monitor(m_cond);
     if (m_finalized)
     {
-        m_log.Emsg("Join", "Prefetch is already finalized");
+        TRACE(kDebug, "Prefetch::Join", "already finalized", 0, 0);
         return;
     }
     else if (m_started)
     {
-        m_log.Emsg("Join", "Waiting until prefetch finishes");
-        m_cond.Wait();
-        m_log.Emsg("Join", "Prefetch finished");
+        TRACE(kDebug, "Prefetch::Join", "waiting until prefetch finishes", 0, 0);
+        while (!m_finalized)
+            m_cond.Wait();
     }
     else
     {
-        m_log.Emsg("Join", "Prefetch not started - running it before Joining");
+        TRACE(kDebug, "Prefetch::Join", "not started, running it before joining", 0, 0);
         monitor.UnLock();
         // Because we have unlocked the mutex, someone else may be
         // able to race us and Run - causing us to exit early.
@@ -125,16 +554,6 @@ Prefetch::Join()
     }
 }
 
-bool
-Prefetch::GetTempFilename(std::string &result)
-{ 
-    Cache::getFilePathFromURL(m_input.Path(), result);
-    std::string &tmp_directory = Factory::GetInstance().GetTempDirectory();
-    result = tmp_directory + result + ".tmp";
-
-    return true;
-}
-
 bool
 Prefetch::Open()
 {
@@ -146,59 +565,157 @@ Prefetch::Open()
     // Finalize temporary turned on in case of exception.
     m_finalized = true;
 
-    std::string temp_path;
-
-    if (!GetTempFilename(temp_path))
+    if (!Cache::getCachePathFromURL(m_path.c_str(), m_data_filename))
     {
-        m_log.Emsg("Open", "Failed to create temporary filename for ", m_input.Path());
+        m_log.Emsg("Open", "Failed to create cache filename for ", m_path.c_str());
         return false;
     }
-    m_log.Emsg("Open", ("Opening temp file " + temp_path).c_str(), " to prefetch file ", m_input.Path());
+    m_info_filename = m_data_filename + Info::m_suffix;
+    __atomic_store_n(&m_dir, Factory::GetInstance().GetCacheDirs().Find(m_data_filename), __ATOMIC_RELAXED);
+    if (TRACE_ON(kInfo))
+        m_log.Emsg("Open", ("Opening cache file " + m_data_filename).c_str(),
+                   m_sparse ? " to cache sparse file " : " to prefetch file ", m_path.c_str());
 
-    // Create the file itself.
+    // Create the data and info files themselves.
     XrdOucEnv myEnv;
+    const char *username = Factory::GetInstance().GetUsername().c_str();
    
-    m_output_fs.Create(Factory::GetInstance().GetUsername().c_str(), temp_path.c_str(), 0600, myEnv, XRDOSS_mkpath);
-    m_output = m_output_fs.newFile(Factory::GetInstance().GetUsername().c_str());
-    if (!m_output || m_output->Open(temp_path.c_str(), O_WRONLY, 0600, myEnv) < 0)
+    m_output_fs.Create(username, m_data_filename.c_str(), 0600, myEnv, XRDOSS_mkpath);
+    m_output = m_output_fs.newFile(username);
+    int retval;
+    if (!m_output || (retval = m_output->Open(m_data_filename.c_str(), O_RDWR, 0600, myEnv)) < 0)
     {
-        return false;
+        if (m_output)
+            Factory::GetInstance().GetCacheDirs().ReportError(m_data_filename, retval);
+        return OpenFailed();
+    }
+    // The buffered handle stays open for the unaligned tail block.
+    if (Factory::GetInstance().GetDirectFill() || Factory::GetInstance().GetDirectRead())
+    {
+        m_output_direct = m_output_fs.newFile(username);
+        if (m_output_direct && m_output_direct->Open(m_data_filename.c_str(), O_RDWR | DirectIO::OpenFlag(), 0600, myEnv) < 0)
+        {
+            m_log.Emsg("Open", "Direct I/O not available, using buffered I/O for ", m_data_filename.c_str());
+            delete m_output_direct;
+            m_output_direct = NULL;
+        }
+    }
+
+    m_output_fs.Create(username, m_info_filename.c_str(), 0600, myEnv, XRDOSS_mkpath);
+    m_info_file = m_output_fs.newFile(username);
+    if (!m_info_file || (retval = m_info_file->Open(m_info_filename.c_str(), O_RDWR, 0600, myEnv)) < 0)
+    {
+        if (m_info_file)
+            Factory::GetInstance().GetCacheDirs().ReportError(m_info_filename, retval);
+        return OpenFailed();
     }
 
-    // If the file is pre-existing, pick up from where we left off.
-    struct stat fileStat;
-   m_temp_filename = temp_path;
-    if (m_output->Fstat(&fileStat) == 0)
+    // If the file is pre-existing, pick up the blocks we already have.
+    long long blockSize = Factory::GetInstance().GetBlockSize();
+    bool have_info = m_info.Read(m_info_file);
+    if (have_info && m_info.GetFileSize() == m_file_size)
     {
-        m_offset = fileStat.st_size;
+        if (TRACE_ON(kInfo))
+        {
+            std::stringstream ss;
+            ss << "Resuming with " << m_info.GetBlocksPresent() << " of " << m_info.GetNumBlocks() << " blocks present";
+            m_log.Emsg("Open", ss.str().c_str(), " for ", m_path.c_str());
+        }
+    }
+    else
+    {
+        m_info.Init(m_file_size, blockSize);
+        m_info.Write(m_info_file);
+        // The origin file changed; forget any blocks of the old one.
+        if (have_info)
+        {
+            Factory::GetInstance().GetRamCache().Remove(m_data_filename);
+            m_output->Ftruncate(m_file_size);
+        }
+        if (Factory::GetInstance().GetPreallocate() && !m_sparse)
+            Preallocate();
     }
+    m_claimed.assign(m_info.GetNumBlocks(), false);
+
+    UpdateCatalog();
 
     m_finalized = false;
+    __atomic_store_n(&m_readable, true, __ATOMIC_RELEASE);
     return true;
 }
 
+/*
+ * Record the space the data file takes up on disk, which is what the purge
+ * has to free: the blocks present for a sparse file, the whole file once
+ * it has been preallocated.  Must be called with m_cond held.
+ */
+void
+Prefetch::UpdateCatalog()
+{
+    Factory::GetInstance().GetCatalog().Update(m_data_filename, m_output, m_info.GetBytesPresent(), m_info.IsComplete());
+}
+
+/*
+ * Reserve the whole data file up front.  Failure is not fatal: the blocks
+ * are still written as they arrive, only without the guarantee of space.
+ */
+void
+Prefetch::Preallocate()
+{
+#if defined(__linux__)
+    int fd = m_output->getFD();
+    if (fd < 0 || m_file_size <= 0)
+        return;
+    if (fallocate(fd, 0, 0, m_file_size) < 0 && errno != EOPNOTSUPP)
+        m_log.Emsg("Open", errno, "preallocate", m_data_filename.c_str());
+#endif
+}
+
+// Drop whatever Open had opened before it failed; m_finalized stays set.
+// Must be called with m_cond locked.
 bool
-Prefetch::Close()
+Prefetch::OpenFailed()
 {
-    XrdSysCondVarHelper monitor(m_cond);
-    if (!m_started) {
-        return false;
+    if (m_info_file)
+    {
+        m_info_file->Close();
+        delete m_info_file;
+        m_info_file = NULL;
+    }
+    if (m_output_direct)
+    {
+        m_output_direct->Close();
+        delete m_output_direct;
+        m_output_direct = NULL;
     }
-
     if (m_output)
     {
-        m_log.Emsg("Close", "Close m_output");
         m_output->Close();
         delete m_output;
         m_output = NULL;
     }
+    return false;
+}
 
-    // final file has same name , except of missing '.tmp' extension
-    std::string finalName = m_temp_filename.substr(0, m_temp_filename.size()-4);
+bool
+Prefetch::Close()
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    if (!m_started) {
+        return false;
+    }
 
-    m_log.Emsg("Close", m_temp_filename.c_str(), "  rename " ,finalName.c_str());
-    m_output_fs.Rename(m_temp_filename.c_str(), finalName.c_str());
+    if (m_info_file)
+    {
+        TRACE(kDebug, "Prefetch::Close", "blocks present", m_info.GetBlocksPresent(), m_info.GetNumBlocks());
+        m_info.Write(m_info_file);
+        UpdateCatalog();
+        m_info_file->Close();
+        delete m_info_file;
+        m_info_file = NULL;
+    }
 
+    // m_output stays open until we are destroyed; readers use it unlocked.
     m_cond.Broadcast();
     m_finalized = true;
 
@@ -214,16 +731,21 @@ Prefetch::Fail(bool cleanup)
     if (!m_started)
         return false;
    
-    if (m_output)
+    if (m_info_file)
     {
-       m_log.Emsg("Fail", "Close m_output");
-        m_output->Close();
-        delete m_output;
-        m_output = NULL;
+        if (!cleanup) m_info.Write(m_info_file);
+        m_info_file->Close();
+        delete m_info_file;
+        m_info_file = NULL;
+    }
+
+    if (cleanup && !m_data_filename.empty())
+    {
+        m_output_fs.Unlink(m_data_filename.c_str());
+        m_output_fs.Unlink(m_info_filename.c_str());
+        Factory::GetInstance().GetCatalog().Remove(m_data_filename);
+        Factory::GetInstance().GetRamCache().Remove(m_data_filename);
     }
-   
-    if (cleanup && !m_temp_filename.empty())
-        m_output_fs.Unlink(m_temp_filename.c_str());
 
     m_cond.Broadcast();
     m_finalized = true;
@@ -232,51 +754,172 @@ Prefetch::Fail(bool cleanup)
 
 Prefetch::~Prefetch()
 {
-    m_log.Emsg("Destructor", "Destroying Prefetch Object");
     Join();
+
+    if (m_output_direct)
+    {
+        m_output_direct->Close();
+        delete m_output_direct;
+        m_output_direct = NULL;
+    }
+    if (m_output)
+    {
+        m_output->Close();
+        delete m_output;
+        m_output = NULL;
+    }
 }
 
+/*
+ * Read from the data file the run of present blocks starting at offset.
+ * Returns 0 if the first block is missing; the caller fetches the rest.
+ *
+ * No lock is taken: the info geometry and m_output are fixed once
+ * m_readable is published, and bits are set after the block's data has
+ * been written.  They are only cleared for blocks which failed their
+ * checksum, whose data was no good to a reader anyway.  Reads continue to be served after
+ * the prefetch has finished, until the object is destroyed.
+ */
 ssize_t
 Prefetch::Read(char *buff, off_t offset, size_t size)
 {
-    XrdSysCondVarHelper monitor(m_cond);
-    if (!m_started || m_finalized) {
+    if (!__atomic_load_n(&m_readable, __ATOMIC_ACQUIRE)) {
         errno = EBADF;
         return -errno;
     }
-    // TODO: if the file has been finalized, we could read it from its final location
+    time_t now = time(0);
+    if (__atomic_load_n(&m_last_access, __ATOMIC_RELAXED) != now)
+        __atomic_store_n(&m_last_access, now, __ATOMIC_RELAXED);
 
-    std::stringstream ss;
-    ss << "offset = " << offset;
+    long long available = offset + VerifyRun(offset, m_info.GetCachedRun(offset, size));
+    TRACE(kDump, "Prefetch::Read", "offset cached", offset, available - offset);
+    if (available <= offset)
+        return 0;
+    ssize_t retval;
+    if (m_output_direct && Factory::GetInstance().GetDirectRead())
+        retval = DirectIO::Read(m_output_direct, buff, offset, available - offset);
+    else
+        retval = m_output->Read(buff, offset, available - offset);
+    if (retval < 0)
+        Factory::GetInstance().GetCacheDirs().ReportError(m_data_filename, retval);
+    return retval;
+}
 
 
 
-    off_t prefetch_offset = GetOffset();
-    if (prefetch_offset < offset)
-    {
-        m_log.Emsg("Read", "Offset below requested offset. Nothing to read.", ss.str().c_str());
+long long
+Prefetch::CachedRun(off_t offset, size_t size)
+{
+    if (!__atomic_load_n(&m_readable, __ATOMIC_ACQUIRE))
         return 0;
-    }
-    else if (prefetch_offset >= static_cast<off_t>(offset + size))
+    return VerifyRun(offset, m_info.GetCachedRun(offset, size));
+}
+
+/*
+ * Check the blocks of a cached run which have not been checked since the
+ * info file was loaded, and cut the run short before the first bad one.
+ */
+long long
+Prefetch::VerifyRun(off_t offset, long long run)
+{
+    if (run <= 0 || !Factory::GetInstance().GetVerify())
+        return run;
+    long long blockSize = m_info.GetBlockSize();
+    int last = (offset + run - 1) / blockSize;
+    for (int block = offset / blockSize; block <= last; block++)
     {
-       ss << ", size  = " << size;
-       m_log.Emsg("Read", "read complete size", ss.str().c_str());
-       return m_output->Read(buff, offset, size);
+        if (!m_info.TestVerified(block) && !VerifyBlock(block))
+            return std::max(0LL, block * blockSize - offset);
     }
+    return run;
+}
+
+/*
+ * Read a whole block back from the data file and compare it with its
+ * checksum.  Readers racing on the same block may both check it.
+ */
+bool
+Prefetch::VerifyBlock(int block)
+{
+    off_t offset = block * m_info.GetBlockSize();
+    long long length = m_info.GetBlockLength(block);
+    BufferPool::Buffer buff(length);
+    ssize_t retval;
+    if (m_output_direct && Factory::GetInstance().GetDirectRead())
+        retval = DirectIO::Read(m_output_direct, buff.Get(), offset, length);
     else
+        retval = m_output->Read(buff.Get(), offset, length);
+    if (retval == length && Crc32c::Compute(buff.Get(), length) == m_info.GetChecksum(block))
     {
-       size_t to_read = offset + size - prefetch_offset;
-       ss << ", to_read  = " << to_read;
+        m_info.SetVerified(block);
+        Factory::GetInstance().GetStatistics().Add(Statistics::kBytesVerified, length);
+        return true;
+    }
+    if (retval < 0)
+        Factory::GetInstance().GetCacheDirs().ReportError(m_data_filename, retval);
+    DropBadBlock(block);
+    return false;
+}
 
-       m_log.Emsg("Read", "read partial read ", ss.str().c_str());
-       return m_output->Read(buff, offset, to_read);
+/*
+ * Forget a block which failed its check, so that readers go to the origin
+ * for it and it is fetched again: by the client miss path, which writes
+ * back missing blocks, or by a worker.  Once the prefetch has finished the
+ * info file is closed and the block is only dropped in memory; it will
+ * fail again, and be refetched, when the file is next opened.
+ */
+void
+Prefetch::DropBadBlock(int block)
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    if (!m_info.TestBlock(block) || m_info.TestVerified(block))
+        return;
+    std::stringstream ss;
+    ss << "Block " << block << " failed its checksum; refetching";
+    m_log.Emsg("Verify", ss.str().c_str(), " for ", m_data_filename.c_str());
+    Factory::GetInstance().GetStatistics().Add(Statistics::kBadBlocks, 1);
+
+    m_info.ClearBlockPresent(block);
+    if (m_info_file)
+        m_info.Write(m_info_file);
+    UpdateCatalog();
+    if (!m_finalized && !m_stop)
+    {
+        if (m_wanted.size() >= m_max_wanted)
+            m_wanted.pop_front();
+        m_wanted.push_back(std::make_pair(block, block + 1));
     }
 }
 
+#if defined(HAVE_READV)
+/*
+ * Vectored read of ranges the caller has checked with CachedRun.
+ */
+ssize_t
+Prefetch::ReadV(XrdOucIOVec *readV, int n)
+{
+    if (!__atomic_load_n(&m_readable, __ATOMIC_ACQUIRE)) {
+        errno = EBADF;
+        return -errno;
+    }
+    time_t now = time(0);
+    if (__atomic_load_n(&m_last_access, __ATOMIC_RELAXED) != now)
+        __atomic_store_n(&m_last_access, now, __ATOMIC_RELAXED);
+    if (m_output_direct && Factory::GetInstance().GetDirectRead())
+        return DirectIO::ReadV(m_output_direct, readV, n);
+    return m_output->ReadV(readV, n);
+}
+#endif
 
+bool
+Prefetch::HasEnded()
+{
+    XrdSysCondVarHelper monitor(m_cond);
+    return m_finalized && (!__atomic_load_n(&m_readable, __ATOMIC_ACQUIRE) || m_stop || !m_info.IsComplete());
+}
 
 bool
 Prefetch::hasCompletedSuccessfully() const
 {
-   return m_finalized == true && m_stop == false;
+   return m_finalized == true && m_stop == false && m_info.IsComplete();
 }
@@ -5,21 +5,28 @@
  */
 #include <string.h>
 #include <string>
+#include <vector>
+#include <deque>
+#include <utility>
 #include <XrdSys/XrdSysPthread.hh>
 #include <XrdOss/XrdOss.hh>
 #include <XrdOuc/XrdOucCache.hh>
 
 #include "XrdFileCacheFwd.hh"
+#include "Info.hh"
 
 namespace XrdFileCache {
 
 class Prefetch {
 
 friend class IO;
+friend class Scheduler;
+friend class Cache;
+friend class Factory;
 
 public:
 
-    Prefetch(XrdSysError &log, XrdOss& outputFS, XrdOucCacheIO & inputFile);
+    Prefetch(XrdSysError &log, XrdOss& outputFS, XrdOucCacheIO & inputFile, bool sparse = false);
     ~Prefetch();
 
     void Run();
@@ -28,30 +35,89 @@ public:
 protected:
 
     ssize_t Read(char * buff, off_t offset, size_t size);
+    long long CachedRun(off_t offset, size_t size);
+#if defined(HAVE_READV)
+    ssize_t ReadV(XrdOucIOVec *readV, int n);
+#endif
+    void WriteBlocks(const char * buff, off_t offset, size_t size);
+    long long GetBlockSize();
     void CloseCleanly();
+    void AddReader(XrdOucCacheIO *);
+    void RemoveReader(XrdOucCacheIO *);
+    bool IsActive();
+    bool Readahead(long long offset, long long length);
+    void SetFullPrefetch(bool);
   
     bool hasCompletedSuccessfully() const;
 
+    // Finalized without the whole file: stopped, failed or never opened.
+    // It takes no more readers; a new client needs a new Prefetch.
+    bool HasEnded();
+
+    // A sparse file only gets the blocks clients read and ask to have
+    // read ahead; it is never fetched whole.
+    bool IsSparse() const {return m_sparse;}
+
+    // Index of the cache directory holding the file, -1 until it is open.
+    int GetCacheDir() const {return __atomic_load_n(&m_dir, __ATOMIC_RELAXED);}
+
+    int GetNextBlock(int &count);
+    void DoBlocks(int block, int count);
+    bool HasMoreWork();
+    void Finish();
+
 private:
 
-    inline off_t GetOffset() {return __sync_fetch_and_or(&m_offset, 0);}
-    bool GetTempFilename(std::string&);
+    int ClaimBlocks(int block, int limit, int &count);
+    int FetchBlocks(char *buff, int block, int count);
+    ssize_t ReadInput(char *buff, off_t offset, size_t size);
+    ssize_t ReadInput(XrdOucCacheIO *input, char *buff, off_t offset, size_t size);
+    bool WriteToOutput(const char *buff, off_t offset, size_t size);
+    void MarkBlockPresent(int block, unsigned int crc);
+    long long VerifyRun(off_t offset, long long run);
+    bool VerifyBlock(int block);
+    void DropBadBlock(int block);
+    void UpdateCatalog();
 
     XrdOss & m_output_fs;
    
     XrdOssDF *m_output;
+    XrdOssDF *m_output_direct; // O_DIRECT handle on the data file, if enabled
+    XrdOssDF *m_info_file;
+    Info m_info;
+    int m_blocks_since_sync;
+    int m_next_block;
+    bool m_full;
+    const bool m_sparse;
+    std::deque<std::pair<int, int> > m_wanted; // block ranges, [first, last)
+    std::vector<bool> m_claimed;
+    int m_in_flight;
+    int m_error;
    
-    XrdOucCacheIO & m_input;
-    off_t m_offset;
-    static const size_t m_buffer_size;
+    XrdOucCacheIO *m_input;
+    int m_input_users;
+    std::vector<XrdOucCacheIO*> m_readers;
+    std::string m_path;
+    long long m_file_size;
+    time_t m_last_access; // atomic; the read paths set it unlocked
+    static const int m_info_sync_blocks;
+    static const int m_active_window;
+    static const size_t m_max_wanted;
     bool m_started;
     bool m_finalized;
     bool m_stop;
+    bool m_finishing;
+    bool m_readable; // set once Open succeeds; read without the lock
+    bool m_queued; // protected by the Scheduler's lock
     XrdSysCondVar m_cond;
     XrdSysError m_log;
-    std::string m_temp_filename;
+    std::string m_data_filename;
+    std::string m_info_filename;
+    int m_dir;
 
     bool Open();
+    bool OpenFailed();
+    void Preallocate();
     bool Close();
     bool Fail(bool cleanup);
 
@@ -0,0 +1,260 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "XrdSys/XrdSysError.hh"
+
+#include "RamCache.hh"
+
+using namespace XrdFileCache;
+
+const int RamCache::m_num_shards = 16;
+
+RamCache::RamCache(XrdSysError &log)
+    : m_log(log),
+      m_block_size(0),
+      m_slab(NULL),
+      m_shards(NULL)
+{
+}
+
+RamCache::~RamCache()
+{
+    delete [] m_shards;
+    free(m_slab);
+}
+
+bool
+RamCache::Init(long long size, long long blockSize)
+{
+    long long slots_per_shard = size / blockSize / m_num_shards;
+    if (slots_per_shard <= 0)
+    {
+        if (size)
+            m_log.Emsg("RamCache", "ramsize is too small for the block size; RAM cache disabled");
+        return true;
+    }
+
+    void *slab;
+    int retval = posix_memalign(&slab, 4096, slots_per_shard * m_num_shards * blockSize);
+    if (retval)
+    {
+        m_log.Emsg("RamCache", retval, "allocate RAM cache");
+        return false;
+    }
+    m_slab = static_cast<char *>(slab);
+    m_block_size = blockSize;
+    m_shards = new Shard[m_num_shards];
+    for (int i = 0; i < m_num_shards; i++)
+    {
+        Shard &shard = m_shards[i];
+        shard.m_slots.resize(slots_per_shard);
+        shard.m_data = m_slab + i * slots_per_shard * blockSize;
+        shard.m_head = shard.m_tail = -1;
+        shard.m_removals = 0;
+        for (int slot = slots_per_shard - 1; slot >= 0; slot--)
+            shard.m_free.push_back(slot);
+    }
+    return true;
+}
+
+void
+RamCache::Unlink(Shard &shard, int slot)
+{
+    Slot &s = shard.m_slots[slot];
+    if (s.m_prev >= 0) shard.m_slots[s.m_prev].m_next = s.m_next;
+    else shard.m_head = s.m_next;
+    if (s.m_next >= 0) shard.m_slots[s.m_next].m_prev = s.m_prev;
+    else shard.m_tail = s.m_prev;
+    s.m_prev = s.m_next = -1;
+}
+
+void
+RamCache::PushFront(Shard &shard, int slot)
+{
+    Slot &s = shard.m_slots[slot];
+    s.m_prev = -1;
+    s.m_next = shard.m_head;
+    if (shard.m_head >= 0) shard.m_slots[shard.m_head].m_prev = slot;
+    shard.m_head = slot;
+    if (shard.m_tail < 0) shard.m_tail = slot;
+}
+
+// Must be called with the shard locked.
+void
+RamCache::Release(Shard &shard, int slot)
+{
+    Slot &s = shard.m_slots[slot];
+    if (--s.m_refs == 0 && s.m_orphan)
+    {
+        s.m_orphan = false;
+        shard.m_free.push_back(slot);
+    }
+}
+
+// Must be called with the shard locked.
+void
+RamCache::Unindex(Shard &shard, int slot)
+{
+    const Key &key = shard.m_slots[slot].m_key;
+    PathMap::iterator it = shard.m_paths.find(key.m_path);
+    if (it != shard.m_paths.end())
+    {
+        it->second.erase(slot);
+        if (it->second.empty())
+            shard.m_paths.erase(it);
+    }
+    shard.m_index.erase(key);
+}
+
+/*
+ * Take a free slot, or evict the least recently used unpinned one.
+ * Returns -1 if every slot is pinned.  Must be called with the shard
+ * locked.
+ */
+int
+RamCache::TakeSlot(Shard &shard)
+{
+    if (!shard.m_free.empty())
+    {
+        int slot = shard.m_free.back();
+        shard.m_free.pop_back();
+        return slot;
+    }
+    for (int slot = shard.m_tail; slot >= 0; slot = shard.m_slots[slot].m_prev)
+    {
+        if (shard.m_slots[slot].m_refs)
+            continue;
+        Unlink(shard, slot);
+        Unindex(shard, slot);
+        return slot;
+    }
+    return -1;
+}
+
+bool
+RamCache::Read(const std::string &path, int block, long long offset, char *buff, long long size)
+{
+    Key key;
+    key.m_path = path;
+    key.m_block = block;
+    Shard &shard = GetShard(key);
+
+    int slot;
+    {
+        XrdSysMutexHelper lock(shard.m_mutex);
+        SlotMap::iterator it = shard.m_index.find(key);
+        if (it == shard.m_index.end())
+            return false;
+        slot = it->second;
+        if (offset + size > shard.m_slots[slot].m_length)
+            return false;
+        shard.m_slots[slot].m_refs++;
+        Unlink(shard, slot);
+        PushFront(shard, slot);
+    }
+
+    memcpy(buff, shard.m_data + slot * m_block_size + offset, size);
+
+    XrdSysMutexHelper lock(shard.m_mutex);
+    Release(shard, slot);
+    return true;
+}
+
+/*
+ * The ghost list remembers twice as many blocks as the shard holds, which
+ * is the window in which a second request gets a block admitted.
+ */
+bool
+RamCache::Admit(const std::string &path, int block)
+{
+    Key key;
+    key.m_path = path;
+    key.m_block = block;
+    Shard &shard = GetShard(key);
+
+    XrdSysMutexHelper lock(shard.m_mutex);
+    GhostMap::iterator it = shard.m_ghost.find(key);
+    if (it != shard.m_ghost.end())
+    {
+        shard.m_ghost_fifo.erase(it->second);
+        shard.m_ghost.erase(it);
+        return true;
+    }
+    if (shard.m_ghost.size() >= 2 * shard.m_slots.size())
+    {
+        shard.m_ghost.erase(shard.m_ghost_fifo.front());
+        shard.m_ghost_fifo.pop_front();
+    }
+    shard.m_ghost[key] = shard.m_ghost_fifo.insert(shard.m_ghost_fifo.end(), key);
+    return false;
+}
+
+void
+RamCache::Insert(const std::string &path, int block, const char *data, long long length)
+{
+    if (length > m_block_size)
+        return;
+    Key key;
+    key.m_path = path;
+    key.m_block = block;
+    Shard &shard = GetShard(key);
+
+    int slot;
+    long long removals;
+    {
+        XrdSysMutexHelper lock(shard.m_mutex);
+        if (shard.m_index.count(key) || (slot = TakeSlot(shard)) < 0)
+            return;
+        removals = shard.m_removals;
+        // Neither indexed nor on the LRU list, the slot is ours to fill.
+        Slot &s = shard.m_slots[slot];
+        s.m_key = key;
+        s.m_length = length;
+        s.m_refs = 1;
+        s.m_orphan = false;
+        s.m_prev = s.m_next = -1;
+    }
+
+    memcpy(shard.m_data + slot * m_block_size, data, length);
+
+    XrdSysMutexHelper lock(shard.m_mutex);
+    if (shard.m_index.count(key) || shard.m_removals != removals)
+    {
+        // Someone else loaded the same block meanwhile, or the file may
+        // have been removed.
+        shard.m_slots[slot].m_refs = 0;
+        shard.m_free.push_back(slot);
+        return;
+    }
+    shard.m_index[key] = slot;
+    shard.m_paths[path].insert(slot);
+    PushFront(shard, slot);
+    Release(shard, slot);
+}
+
+void
+RamCache::Remove(const std::string &path)
+{
+    if (!m_shards)
+        return;
+    for (int i = 0; i < m_num_shards; i++)
+    {
+        Shard &shard = m_shards[i];
+        XrdSysMutexHelper lock(shard.m_mutex);
+        shard.m_removals++;
+        PathMap::iterator it = shard.m_paths.find(path);
+        if (it == shard.m_paths.end())
+            continue;
+        for (std::set<int>::const_iterator slot = it->second.begin(); slot != it->second.end(); ++slot)
+        {
+            shard.m_index.erase(shard.m_slots[*slot].m_key);
+            Unlink(shard, *slot);
+            if (shard.m_slots[*slot].m_refs)
+                shard.m_slots[*slot].m_orphan = true;
+            else
+                shard.m_free.push_back(*slot);
+        }
+        shard.m_paths.erase(it);
+    }
+}
@@ -0,0 +1,126 @@
+#ifndef __XRDFILECACHE_RAMCACHE_HH__
+#define __XRDFILECACHE_RAMCACHE_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * Bounded in-memory copy of cache blocks, keyed by cache file and block
+ * number, in front of the cache disk.  The memory is one slab carved into
+ * block-sized slots at configuration time.  Slots are split between
+ * independently locked shards so that lookups on different blocks rarely
+ * contend; data is copied in and out with the shard unlocked while the
+ * slot is pinned.
+ *
+ * Replacement is LRU behind a 2Q-style admission filter: a block is only
+ * loaded once it has been asked for twice within the recent history kept
+ * in a ghost list, so a single scan through a large file cannot flush the
+ * blocks which are read over and over.
+ */
+
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <XrdSys/XrdSysPthread.hh>
+
+#include "XrdFileCacheFwd.hh"
+
+class XrdSysError;
+
+namespace XrdFileCache {
+
+class RamCache
+{
+
+public:
+
+    RamCache(XrdSysError &);
+    ~RamCache();
+
+    // Allocate size bytes of blocks of blockSize; size 0 leaves the cache
+    // disabled.
+    bool Init(long long size, long long blockSize);
+
+    bool IsEnabled() const {return m_slab != NULL;}
+    long long GetBlockSize() const {return m_block_size;}
+
+    // Copy size bytes starting offset bytes into the block; false if the
+    // block is not resident.
+    bool Read(const std::string &path, int block, long long offset, char *buff, long long size);
+
+    // Called for a block which is not resident: true if it was asked for
+    // recently and should now be loaded, otherwise remember it.
+    bool Admit(const std::string &path, int block);
+
+    void Insert(const std::string &path, int block, const char *data, long long length);
+
+    // Drop every block of a file which has left the disk cache.
+    void Remove(const std::string &path);
+
+private:
+
+    struct Key
+    {
+        std::string m_path;
+        int m_block;
+        bool operator==(const Key &other) const {return m_block == other.m_block && m_path == other.m_path;}
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const {return std::tr1::hash<std::string>()(key.m_path) * 31 + key.m_block;}
+    };
+
+    struct Slot
+    {
+        Key m_key;
+        long long m_length;
+        int m_refs;
+        bool m_orphan;    // removed while pinned; freed on release
+        int m_prev;       // LRU neighbours, -1 at the ends
+        int m_next;
+    };
+
+    typedef std::tr1::unordered_map<Key, int, KeyHash> SlotMap;
+    typedef std::tr1::unordered_map<Key, std::list<Key>::iterator, KeyHash> GhostMap;
+    typedef std::tr1::unordered_map<std::string, std::set<int> > PathMap;
+
+    struct Shard
+    {
+        XrdSysMutex m_mutex;
+        std::vector<Slot> m_slots;
+        char *m_data;
+        SlotMap m_index;
+        PathMap m_paths;  // the indexed slots of each file
+        std::vector<int> m_free;
+        int m_head;       // most recently used
+        int m_tail;
+        std::list<Key> m_ghost_fifo; // oldest at the front
+        GhostMap m_ghost;
+        long long m_removals; // bumped by Remove, so fills can spot a race
+    };
+
+    Shard &GetShard(const Key &key) {return m_shards[KeyHash()(key) % m_num_shards];}
+    static void Unlink(Shard &, int slot);
+    static void PushFront(Shard &, int slot);
+    static void Release(Shard &, int slot);
+    static void Unindex(Shard &, int slot);
+    int TakeSlot(Shard &);
+
+    static const int m_num_shards;
+
+    XrdSysError & m_log;
+    long long m_block_size;
+    char *m_slab;
+    Shard *m_shards;
+
+};
+
+}
+
+#endif
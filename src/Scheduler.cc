@@ -0,0 +1,192 @@
+
+#include <vector>
+#include <sys/time.h>
+
+#include "XrdSys/XrdSysPthread.hh"
+#include "XrdSys/XrdSysError.hh"
+
+#include "Scheduler.hh"
+#include "Prefetch.hh"
+#include "Factory.hh"
+#include "CacheDirs.hh"
+
+using namespace XrdFileCache;
+
+// Files at the head of a queue considered when balancing load over cache
+// directories.
+const int Scheduler::m_balance_window = 8;
+
+namespace
+{
+double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+}
+
+void *SchedulerWorker(void * scheduler_void)
+{
+    Scheduler *scheduler = static_cast<Scheduler *>(scheduler_void);
+    if (scheduler)
+        scheduler->Worker();
+    return NULL;
+}
+
+Scheduler::Scheduler(XrdSysError &log)
+    : m_cond(0),
+      m_bw_cond(0),
+      m_rate(0),
+      m_tokens(0),
+      m_last_refill(Now()),
+      m_log(log)
+{
+    for (int i = 0; i < kNumPriorities; ++i)
+        m_waiting[i] = 0;
+}
+
+bool
+Scheduler::Start(int nthreads)
+{
+    for (int i = 0; i < nthreads; ++i)
+    {
+        pthread_t tid;
+        if (XrdSysThread::Run(&tid, SchedulerWorker, (void *)this, 0, "XrdFileCache Prefetcher"))
+        {
+            m_log.Emsg("Scheduler", errno, "start prefetch worker");
+            return i > 0;
+        }
+    }
+    return true;
+}
+
+void
+Scheduler::Schedule(PrefetchPtr prefetch)
+{
+    bool active = prefetch->IsActive();
+    XrdSysCondVarHelper monitor(m_cond);
+    if (prefetch->m_queued)
+        return;
+    prefetch->m_queued = true;
+    if (active)
+        m_readahead_queue.push_back(prefetch);
+    else
+        m_background_queue.push_back(prefetch);
+    m_cond.Signal();
+}
+
+// Must be called with m_bw_cond held.  The bucket holds at most one second
+// worth of budget so an idle period cannot turn into a long burst.
+void
+Scheduler::Refill()
+{
+    double now = Now();
+    m_tokens += (now - m_last_refill) * m_rate;
+    if (m_tokens > m_rate)
+        m_tokens = m_rate;
+    m_last_refill = now;
+}
+
+/*
+ * A request may go once no higher priority request is waiting and the
+ * bucket is not in debt.  The request is then charged in full, which may
+ * put the bucket into debt and hold back everyone after it.
+ */
+void
+Scheduler::Acquire(long long size, Priority priority)
+{
+    if (!m_rate)
+        return;
+
+    XrdSysCondVarHelper monitor(m_bw_cond);
+    m_waiting[priority]++;
+    while (1)
+    {
+        Refill();
+        bool preempted = false;
+        for (int i = 0; i < priority; ++i)
+            if (m_waiting[i]) preempted = true;
+        if (!preempted && m_tokens >= 0)
+            break;
+        m_bw_cond.WaitMS(10);
+    }
+    m_waiting[priority]--;
+    m_tokens -= size;
+    m_bw_cond.Broadcast();
+}
+
+void
+Scheduler::GetQueueDepths(QueueDepths &depths)
+{
+    {
+        XrdSysCondVarHelper monitor(m_cond);
+        depths.m_readahead = m_readahead_queue.size();
+        depths.m_background = m_background_queue.size();
+    }
+    XrdSysCondVarHelper monitor(m_bw_cond);
+    for (int i = 0; i < kNumPriorities; ++i)
+        depths.m_waiting[i] = m_waiting[i];
+}
+
+/*
+ * Take the file whose cache directory is least busy from the first few in
+ * the queue; ties go to the one nearest the head, which keeps the queue
+ * round-robin when there is a single directory.  Must be called with
+ * m_cond held.
+ */
+PrefetchPtr
+Scheduler::TakeNext(std::deque<PrefetchPtr> &queue)
+{
+    CacheDirs &dirs = Factory::GetInstance().GetCacheDirs();
+    std::deque<PrefetchPtr>::iterator best = queue.begin();
+    int best_load = dirs.GetInFlight((*best)->GetCacheDir());
+    int n = 1;
+    for (std::deque<PrefetchPtr>::iterator it = best + 1; best_load && it != queue.end() && n < m_balance_window; ++it, ++n)
+    {
+        int load = dirs.GetInFlight((*it)->GetCacheDir());
+        if (load < best_load)
+        {
+            best = it;
+            best_load = load;
+        }
+    }
+    PrefetchPtr prefetch = *best;
+    queue.erase(best);
+    return prefetch;
+}
+
+void
+Scheduler::Worker()
+{
+    while (1)
+    {
+        PrefetchPtr prefetch;
+        {
+            XrdSysCondVarHelper monitor(m_cond);
+            while (m_readahead_queue.empty() && m_background_queue.empty())
+                m_cond.Wait();
+            std::deque<PrefetchPtr> &queue = m_readahead_queue.empty() ? m_background_queue : m_readahead_queue;
+            prefetch = TakeNext(queue);
+            prefetch->m_queued = false;
+        }
+
+        int count;
+        int block = prefetch->GetNextBlock(count);
+        if (block < 0)
+        {
+            prefetch->Finish();
+            continue;
+        }
+        // Let another worker claim the next run while we fetch this one.
+        if (prefetch->HasMoreWork())
+            Schedule(prefetch);
+
+        prefetch->DoBlocks(block, count);
+
+        if (prefetch->HasMoreWork())
+            Schedule(prefetch);
+        else
+            prefetch->Finish();
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef __XRDFILECACHE_SCHEDULER_HH__
+#define __XRDFILECACHE_SCHEDULER_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * A fixed pool of prefetch workers shared by all files.  Files waiting for
+ * blocks sit on round-robin queues; a worker takes a file, claims a run
+ * of blocks of at most one write batch, puts the file back at the tail and
+ * fetches the run, so a large file cannot hold a worker for longer than
+ * one batch.  Among the files at the head of a queue, a worker takes the
+ * one whose cache directory has the fewest fetches in progress, so that
+ * no disk is left idle while another has a backlog.
+ *
+ * All origin traffic, client misses included, draws on a single bandwidth
+ * budget.  Requests are served in priority order: blocks a client is
+ * waiting for, then readahead for files being actively read, then
+ * background completion of idle files.
+ */
+
+#include <deque>
+
+#include <XrdSys/XrdSysPthread.hh>
+
+#include "XrdFileCacheFwd.hh"
+
+class XrdSysError;
+
+namespace XrdFileCache {
+
+class Scheduler
+{
+
+public:
+
+    enum Priority {kDemand = 0, kReadahead, kBackground, kNumPriorities};
+
+    struct QueueDepths
+    {
+        int m_readahead;   // files queued for readahead
+        int m_background;  // files queued for background completion
+        int m_waiting[kNumPriorities]; // requests waiting for bandwidth
+    };
+
+    Scheduler(XrdSysError &);
+
+    bool Start(int nthreads);
+
+    // Bytes per second allowed to the origin; 0 means unlimited.
+    void SetBandwidth(long long rate) {m_rate = rate;}
+
+    // Queue a file for prefetching; a file already queued is left in place.
+    void Schedule(PrefetchPtr);
+
+    // Block until size bytes may be read from the origin.
+    void Acquire(long long size, Priority);
+
+    void GetQueueDepths(QueueDepths &);
+
+    void Worker();
+
+private:
+
+    void Refill();
+    PrefetchPtr TakeNext(std::deque<PrefetchPtr> &);
+
+    static const int m_balance_window;
+
+    XrdSysCondVar m_cond;
+    std::deque<PrefetchPtr> m_readahead_queue;
+    std::deque<PrefetchPtr> m_background_queue;
+
+    XrdSysCondVar m_bw_cond;
+    long long m_rate;
+    double m_tokens;
+    double m_last_refill;
+    int m_waiting[kNumPriorities];
+
+    XrdSysError & m_log;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,124 @@
+
+#include <XrdOuc/XrdOucCache.hh>
+
+#include "Statistics.hh"
+
+using namespace XrdFileCache;
+
+namespace
+{
+// Keys used in the snapshot file, in Counter order.
+const char *counter_names[] = {
+    "bytes_ram",
+    "bytes_disk",
+    "bytes_prefetch",
+    "bytes_origin",
+    "hits",
+    "partial_hits",
+    "misses",
+    "bytes_prefetched",
+    "bytes_written_back",
+    "evictions",
+    "bytes_evicted",
+    "open_files",
+    "bytes_verified",
+    "bad_blocks",
+    "decisions_run",
+    "decisions_cached"
+};
+
+// Keys used in the snapshot file, in Latency order.
+const char *latency_names[] = {
+    "read_ram",
+    "read_disk",
+    "read_prefetch",
+    "read_partial",
+    "read_origin",
+    "readv_ram",
+    "readv_disk",
+    "readv_prefetch",
+    "readv_partial",
+    "readv_origin",
+    "prefetch_origin"
+};
+}
+
+Statistics::Statistics()
+{
+    for (int i = 0; i < kNumCounters; i++)
+        m_counters[i].m_value = 0;
+    for (int i = 0; i < kNumLatencies; i++)
+        for (int j = 0; j < Histogram::kNumBuckets; j++)
+            m_last_latency[i].m_buckets[j] = 0;
+}
+
+const char *
+Statistics::GetName(Counter c)
+{
+    return counter_names[c];
+}
+
+const char *
+Statistics::GetName(Latency l)
+{
+    return latency_names[l];
+}
+
+void
+Statistics::AddRead(Counter source, long long ram, long long cached, long long size, bool vector, long long micros)
+{
+    if (ram > 0)
+        Add(kBytesRam, ram);
+    if (cached > ram)
+        Add(source, cached - ram);
+    if (cached < size)
+        Add(kBytesOrigin, size - cached);
+
+    Latency latency;
+    if (cached >= size)
+    {
+        Add(kHits, 1);
+        latency = (ram >= size) ? kReadRam : ((source == kBytesDisk) ? kReadDisk : kReadPrefetch);
+    }
+    else if (cached > 0)
+    {
+        Add(kPartialHits, 1);
+        latency = kReadPartial;
+    }
+    else
+    {
+        Add(kMisses, 1);
+        latency = kReadOrigin;
+    }
+    if (vector)
+        latency = static_cast<Latency>(latency + kReadVRam - kReadRam);
+    AddLatency(latency, micros);
+}
+
+void
+Statistics::GetLatencyInterval(Latency l, Histogram::Snapshot &interval)
+{
+    Histogram::Snapshot now;
+    m_latency[l].Get(now);
+    for (int i = 0; i < Histogram::kNumBuckets; i++)
+        interval.m_buckets[i] = now.m_buckets[i] - m_last_latency[l].m_buckets[i];
+    m_last_latency[l] = now;
+}
+
+/*
+ * BytesGet counts what was delivered from the cache, BytesPass what went
+ * to the origin on behalf of a client, BytesPead what the prefetch workers
+ * fetched and BytesRead everything written into the cache.
+ */
+void
+Statistics::Export(XrdOucCacheStats &stats) const
+{
+    stats.Lock();
+    stats.BytesGet = Get(kBytesRam) + Get(kBytesDisk) + Get(kBytesPrefetch);
+    stats.BytesPass = Get(kBytesOrigin);
+    stats.BytesPead = Get(kBytesPrefetched);
+    stats.BytesRead = Get(kBytesPrefetched) + Get(kBytesWrittenBack);
+    stats.Hits = Get(kHits);
+    stats.Miss = Get(kMisses) + Get(kPartialHits);
+    stats.UnLock();
+}
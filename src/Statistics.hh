@@ -0,0 +1,109 @@
+#ifndef __XRDFILECACHE_STATISTICS_HH__
+#define __XRDFILECACHE_STATISTICS_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * Cache-wide counters, updated with atomic adds from the read and prefetch
+ * paths.  Each counter sits on its own cache line so that threads bumping
+ * different counters do not contend.  Read latencies are kept in
+ * histograms by where the data came from.  Factory periodically folds the
+ * counters into the XrdOucCacheStats seen by the framework and writes a
+ * snapshot file.
+ */
+
+#include <string>
+
+#include "Histogram.hh"
+
+class XrdOucCacheStats;
+
+namespace XrdFileCache {
+
+class Statistics
+{
+
+public:
+
+    enum Counter
+    {
+        kBytesRam = 0,      // client bytes served from the RAM cache
+        kBytesDisk,         // client bytes served from complete cache files
+        kBytesPrefetch,     // client bytes served from files being prefetched
+        kBytesOrigin,       // client bytes fetched from the origin
+        kHits,              // reads served entirely from the cache
+        kPartialHits,       // reads served partly from the cache
+        kMisses,            // reads served entirely from the origin
+        kBytesPrefetched,   // bytes fetched by the prefetch workers
+        kBytesWrittenBack,  // bytes of client misses written to the cache
+        kEvictions,         // files evicted by the purge
+        kBytesEvicted,      // bytes freed by the purge
+        kOpenFiles,         // client handles currently attached
+        kBytesVerified,     // bytes of cached blocks checked against their checksum
+        kBadBlocks,         // cached blocks which failed the check
+        kDecisionsRun,      // opens which ran the decision plugins
+        kDecisionsCached,   // opens which reused an earlier verdict
+        kNumCounters
+    };
+
+    // Client read latencies by source, then origin reads by the prefetch
+    // workers.  The ReadV entries mirror the Read ones in the same order.
+    enum Latency
+    {
+        kReadRam = 0,       // Read served entirely from the RAM cache
+        kReadDisk,          // ... from a complete cache file
+        kReadPrefetch,      // ... from a file being prefetched
+        kReadPartial,       // ... partly from the cache, partly the origin
+        kReadOrigin,        // ... entirely from the origin
+        kReadVRam,
+        kReadVDisk,
+        kReadVPrefetch,
+        kReadVPartial,
+        kReadVOrigin,
+        kPrefetchOrigin,    // block fetched from the origin by a worker
+        kNumLatencies
+    };
+
+    Statistics();
+
+    void Add(Counter c, long long value) {__sync_fetch_and_add(&m_counters[c].m_value, value);}
+    long long Get(Counter c) const {return __atomic_load_n(&m_counters[c].m_value, __ATOMIC_RELAXED);}
+
+    static const char *GetName(Counter c);
+    static const char *GetName(Latency l);
+
+    void AddLatency(Latency l, long long micros) {m_latency[l].Record(micros);}
+
+    // Record how a client read of size bytes which took micros to serve
+    // was served: cached bytes came from the cache, ram of them from RAM
+    // and the rest from the given source.
+    void AddRead(Counter source, long long ram, long long cached, long long size, bool vector, long long micros);
+
+    // Latencies recorded since the previous call; only the snapshot
+    // thread may call this.
+    void GetLatencyInterval(Latency l, Histogram::Snapshot &);
+
+    // Copy the counters into the framework's statistics.
+    void Export(XrdOucCacheStats &) const;
+
+private:
+
+    struct PaddedCounter
+    {
+        long long m_value;
+        char m_pad[64 - sizeof(long long)];
+    };
+
+    PaddedCounter m_counters[kNumCounters];
+    Histogram m_latency[kNumLatencies];
+    Histogram::Snapshot m_last_latency[kNumLatencies];
+
+};
+
+}
+
+#endif
@@ -0,0 +1,193 @@
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "XrdSys/XrdSysError.hh"
+#include "XrdSys/XrdSysPthread.hh"
+
+#include "Trace.hh"
+
+using namespace XrdFileCache;
+
+int Trace::m_level = Trace::kNone;
+
+namespace
+{
+// Events kept per thread between flushes.
+const unsigned long ring_size = 512;
+
+struct Event
+{
+    long long m_time_us;
+    const char *m_where;
+    const char *m_what;
+    long long m_a;
+    long long m_b;
+    int m_level;
+};
+
+/*
+ * Written only by its own thread.  m_head counts the events ever recorded
+ * and is published after the event it covers; m_flushed is only touched
+ * by Flush.  Rings are pushed onto g_rings without a lock; only Flush, under
+ * g_flush_mutex, takes them off.  When its thread exits a ring is marked
+ * dead, and the next Flush writes out what is left in it and frees it.
+ */
+struct Ring
+{
+    Event m_events[ring_size];
+    unsigned long m_head;
+    unsigned long m_flushed;
+    unsigned long m_thread;
+    bool m_dead;
+    Ring *m_next;
+};
+
+Ring *g_rings = NULL;
+__thread Ring *t_ring = NULL;
+XrdSysMutex g_flush_mutex;
+pthread_key_t g_ring_key;
+pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+
+void
+RingThreadExit(void *ring)
+{
+    __atomic_store_n(&static_cast<Ring *>(ring)->m_dead, true, __ATOMIC_RELEASE);
+    t_ring = NULL;
+}
+
+void
+CreateRingKey()
+{
+    pthread_key_create(&g_ring_key, RingThreadExit);
+}
+
+const char *level_names[] = {"none", "info", "debug", "dump"};
+
+Ring *
+NewRing()
+{
+    Ring *ring = new Ring;
+    ring->m_head = 0;
+    ring->m_flushed = 0;
+    ring->m_thread = (unsigned long)XrdSysThread::ID();
+    ring->m_dead = false;
+    ring->m_next = __atomic_load_n(&g_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&g_rings, &ring->m_next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    pthread_once(&g_ring_key_once, CreateRingKey);
+    pthread_setspecific(g_ring_key, ring);
+    return ring;
+}
+
+/*
+ * Take a ring off g_rings; prev is the ring before it, or NULL if it was
+ * the head when the walk passed it.  Threads may have pushed new rings in
+ * front since, in which case the predecessor is looked up again.  Must be
+ * called with g_flush_mutex held.
+ */
+void
+UnlinkRing(Ring *ring, Ring *prev)
+{
+    if (prev)
+    {
+        prev->m_next = ring->m_next;
+        return;
+    }
+    Ring *expected = ring;
+    if (__atomic_compare_exchange_n(&g_rings, &expected, ring->m_next, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+    for (prev = expected; prev->m_next != ring; prev = prev->m_next)
+        ;
+    prev->m_next = ring->m_next;
+}
+}
+
+bool
+Trace::ParseLevel(const char *name, int &level)
+{
+    for (int i = kNone; i <= kDump; i++)
+    {
+        if (!strcmp(name, level_names[i]))
+        {
+            level = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+Trace::Record(int level, const char *where, const char *what, long long a, long long b)
+{
+    Ring *ring = t_ring;
+    if (!ring)
+        ring = t_ring = NewRing();
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    unsigned long head = ring->m_head;
+    Event &event = ring->m_events[head % ring_size];
+    event.m_time_us = now.tv_sec * 1000000LL + now.tv_usec;
+    event.m_where = where;
+    event.m_what = what;
+    event.m_a = a;
+    event.m_b = b;
+    event.m_level = level;
+    __atomic_store_n(&ring->m_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Events are copied out while their thread may be recording over them; a
+ * copy is only used if the head shows the slot was not reused meanwhile.
+ */
+void
+Trace::Flush(XrdSysError &log)
+{
+    XrdSysMutexHelper lock(g_flush_mutex);
+    Ring *prev = NULL;
+    Ring *next;
+    for (Ring *ring = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); ring; ring = next)
+    {
+        next = ring->m_next;
+        // Read before the head, so a dead ring is drained of everything.
+        bool dead = __atomic_load_n(&ring->m_dead, __ATOMIC_ACQUIRE);
+        unsigned long head = __atomic_load_n(&ring->m_head, __ATOMIC_ACQUIRE);
+        unsigned long first = ring->m_flushed;
+        if (head - first > ring_size)
+            first = head - ring_size;
+        unsigned long dropped = first - ring->m_flushed;
+
+        char line[512];
+        for (unsigned long i = first; i < head; i++)
+        {
+            Event event = ring->m_events[i % ring_size];
+            if (__atomic_load_n(&ring->m_head, __ATOMIC_ACQUIRE) >= i + ring_size)
+            {
+                dropped++;
+                continue;
+            }
+            snprintf(line, sizeof(line), "%lx %lld.%06lld %s %s: %s %lld %lld", ring->m_thread,
+                     event.m_time_us / 1000000, event.m_time_us % 1000000, level_names[event.m_level],
+                     event.m_where, event.m_what, event.m_a, event.m_b);
+            log.Emsg("Trace", line);
+        }
+        if (dropped)
+        {
+            snprintf(line, sizeof(line), "%lx dropped %lu events", ring->m_thread, dropped);
+            log.Emsg("Trace", line);
+        }
+        ring->m_flushed = head;
+
+        if (dead)
+        {
+            UnlinkRing(ring, prev);
+            delete ring;
+        }
+        else
+            prev = ring;
+    }
+}
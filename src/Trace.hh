@@ -0,0 +1,53 @@
+#ifndef __XRDFILECACHE_TRACE_HH__
+#define __XRDFILECACHE_TRACE_HH__
+/******************************************************************************/
+/*                                                                            */
+/* (c) 2012 University of Nebraksa-Lincoln                                    */
+/*     by Brian Bockelman                                                     */
+/*                                                                            */
+/******************************************************************************/
+
+/*
+ * Leveled tracing for the hot paths.  A trace point below the configured
+ * level costs one load and one branch.  An enabled one stores a fixed-size
+ * event (two static strings and two numbers) in a ring buffer owned by the
+ * calling thread, without locking or allocating; Flush formats the events
+ * recorded since the last flush into the log.  Each ring keeps only the
+ * most recent events, so a busy thread may lose some between flushes.
+ *
+ * Rare events which carry a file name go straight to the log, guarded by
+ * TRACE_ON.
+ */
+
+class XrdSysError;
+
+namespace XrdFileCache {
+
+class Trace
+{
+
+public:
+
+    enum Level {kNone = 0, kInfo, kDebug, kDump};
+
+    // Parse a level name; returns false if it is not one.
+    static bool ParseLevel(const char *name, int &level);
+
+    // where and what must be string literals; only the pointers are kept.
+    static void Record(int level, const char *where, const char *what, long long a, long long b);
+
+    // Write everything recorded since the last call to the log.
+    static void Flush(XrdSysError &);
+
+    static int m_level;
+
+};
+
+}
+
+#define TRACE_ON(lvl) __builtin_expect(XrdFileCache::Trace::m_level >= XrdFileCache::Trace::lvl, 0)
+
+#define TRACE(lvl, where, what, a, b) \
+    do { if (TRACE_ON(lvl)) XrdFileCache::Trace::Record(XrdFileCache::Trace::lvl, where, what, a, b); } while (0)
+
+#endif
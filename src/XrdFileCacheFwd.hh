@@ -15,6 +15,8 @@ class IO;
 class Factory;
 class Cache;
 class Decision;
+class CachedFile;
+typedef std::tr1::shared_ptr<CachedFile> CachedFilePtr;
 
 }
 
@@ -0,0 +1,143 @@
+//
+// Measure what checking cache blocks against their CRC32C costs.
+//
+// Without a file, checksums a buffer in memory with the hardware and the
+// table-driven code.  With a file, reads it block by block the way the
+// cache verifies blocks on the hit path, plain and checksumming each
+// block, and reports the extra time per GByte.  The file is read once
+// first to warm the page cache; the two kinds of pass then alternate and
+// the fastest of each is kept, so both see the same cache state.
+//
+// Example usage:
+//   ./xrdcrcbench
+//   ./xrdcrcbench /data/xrootd-file-cache/store/data/file.root 1048576
+
+#include "src/Crc32c.hh"
+
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace XrdFileCache;
+
+static double Now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static const double GB = 1024.0 * 1024 * 1024;
+
+// Keeps the checksums from being optimized away.
+static volatile unsigned int sink;
+
+static void BenchMemory()
+{
+  const size_t size = 64 * 1024 * 1024;
+  const int passes = 16;
+  std::vector<char> buf(size);
+  for (size_t i = 0; i < size; ++i)
+    buf[i] = rand();
+
+  unsigned int crc = 0;
+  double start = Now();
+  for (int i = 0; i < passes; ++i)
+    crc ^= Crc32c::Compute(&buf[0], size);
+  double hw = Now() - start;
+
+  start = Now();
+  for (int i = 0; i < passes / 4; ++i)
+    crc ^= Crc32c::ComputeSoftware(&buf[0], size);
+  double sw = (Now() - start) * 4;
+
+  double gbytes = size * passes / GB;
+  printf("crc32c %s: %.2f GB/s, %.1f ms/GB\n", Crc32c::HasHardware() ? "hardware" : "software (no sse4.2)",
+         gbytes / hw, hw / gbytes * 1000);
+  printf("crc32c software: %.2f GB/s, %.1f ms/GB\n", gbytes / sw, sw / gbytes * 1000);
+  sink = crc;
+}
+
+static double ReadFile(int fd, std::vector<char> &buf, bool verify, long long &bytes)
+{
+  unsigned int crc = 0;
+  bytes = 0;
+  double start = Now();
+  ssize_t n;
+  while ((n = pread(fd, &buf[0], buf.size(), bytes)) > 0)
+  {
+    if (verify)
+      crc ^= Crc32c::Compute(&buf[0], n);
+    bytes += n;
+  }
+  if (n < 0)
+  {
+    perror("read");
+    exit(1);
+  }
+  sink = crc;
+  return Now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))
+  {
+    fprintf(stderr,
+            "Usage: %s [file-name [block-size]]\n"
+            "   Without a file, only the in-memory checksum speed is measured.\n"
+            "   The block size defaults to 1MByte, the cache default.\n",
+            argv[0]);
+    return 1;
+  }
+
+  BenchMemory();
+  if (argc < 2)
+    return 0;
+
+  long long block_size = (argc > 2) ? atoll(argv[2]) : 1024 * 1024;
+  if (block_size <= 0)
+  {
+    fprintf(stderr, "Error: block size '%lld' must be larger than zero.\n", block_size);
+    exit(1);
+  }
+
+  int fd = open(argv[1], O_RDONLY);
+  if (fd < 0)
+  {
+    perror(argv[1]);
+    exit(1);
+  }
+
+  const int rounds = 3;
+  std::vector<char> buf(block_size);
+  long long bytes;
+  ReadFile(fd, buf, false, bytes);
+  double plain = 0, verified = 0;
+  for (int i = 0; i < rounds; ++i)
+  {
+    double t = ReadFile(fd, buf, false, bytes);
+    if (i == 0 || t < plain)
+      plain = t;
+    t = ReadFile(fd, buf, true, bytes);
+    if (i == 0 || t < verified)
+      verified = t;
+  }
+  close(fd);
+  if (!bytes)
+  {
+    fprintf(stderr, "Error: '%s' is empty.\n", argv[1]);
+    exit(1);
+  }
+
+  double gbytes = bytes / GB;
+  printf("read: %.1f ms/GB, read and verify: %.1f ms/GB, verification: %.1f ms/GB\n",
+         plain / gbytes * 1000, verified / gbytes * 1000, (verified - plain) / gbytes * 1000);
+  return 0;
+}